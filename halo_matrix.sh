@@ -0,0 +1,27 @@
+# Build src/coawait_halo.cpp with every compiler found and each optimisation
+# level, and print which nested-task shapes had their frames elided.
+# Usage: ./halo_matrix.sh [compiler...]   (default: clang++ g++)
+source=src/coawait_halo.cpp
+out_dir=build/halo
+mkdir -p $out_dir
+compilers=${@:-clang++ g++}
+for cxx in $compilers; do
+    if ! command -v $cxx > /dev/null; then
+        echo "== $cxx: not found, skipped"
+        continue
+    fi
+    for opt in -O0 -O2 -O3; do
+        binary=$out_dir/halo_$(basename $cxx)$opt
+        echo "== $cxx $opt"
+        $cxx -std=c++20 $opt -DHALO_OPT_LEVEL="\"$opt\"" $source -o $binary
+        if [[ $? -ne 0 ]]; then
+            echo "Build failed"
+            exit 1
+        fi
+        $binary
+        if [[ $? -ne 0 ]]; then
+            echo "Run failed"
+            exit 1
+        fi
+    done
+done
@@ -0,0 +1,479 @@
+// channel<T>: a bounded multi-producer multi-consumer channel between
+// coroutines. `co_await ch.send(v)` and `co_await ch.recv()` finish without
+// suspending whenever the ring has room or has an item, which costs a few
+// atomic operations on a lock-free ring and takes no lock. A coroutine that
+// has to wait links its awaiter, which lives in its own frame, into one of
+// the channel's waiter lists, so parking allocates nothing. Whoever next
+// frees or fills a slot finishes the parked operation on its behalf and
+// resumes it.
+//
+// The benchmark runs producer and consumer coroutines against the same
+// number of threads blocking on a mutex + condition_variable queue.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Vyukov's bounded MPMC queue: every cell carries a sequence number that says
+// whether it is ready to be written or read on the current lap.
+template <typename T>
+class MpmcRing {
+    struct Cell {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    static std::size_t round_up(std::size_t n) {
+        std::size_t cap = 1;
+        while (cap < n)
+            cap <<= 1;
+        return cap;
+    }
+
+    const std::size_t mask;
+    std::unique_ptr<Cell[]> cells;
+    alignas(64) std::atomic<std::size_t> tail{0}; // next cell to write
+    alignas(64) std::atomic<std::size_t> head{0}; // next cell to read
+
+  public:
+    explicit MpmcRing(std::size_t capacity)
+        : mask(round_up(capacity) - 1), cells(new Cell[mask + 1]) {
+        for (std::size_t i = 0; i <= mask; i++)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    bool try_push(T &value) {
+        std::size_t pos = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell &cell = cells[pos & mask];
+            const std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+            if (seq == pos) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (seq < pos) {
+                return false; // full
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::optional<T> try_pop() {
+        std::size_t pos = head.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell &cell = cells[pos & mask];
+            const std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+            if (seq == pos + 1) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    std::optional<T> value{std::move(cell.value)};
+                    cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return value;
+                }
+            } else if (seq < pos + 1) {
+                return std::nullopt; // empty
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+};
+
+// Only ever held for a few instructions, and only by coroutines about to park
+// and by whoever wakes them.
+class SpinLock {
+    std::atomic<bool> locked{false};
+
+  public:
+    void lock() {
+        while (locked.exchange(true, std::memory_order_acquire)) {
+            while (locked.load(std::memory_order_relaxed))
+                std::this_thread::yield();
+        }
+    }
+    void unlock() { locked.store(false, std::memory_order_release); }
+};
+
+// Intrusive list node; the awaiters embed it, so it lives in the parked
+// coroutine's frame.
+struct Waiter {
+    Waiter *next = nullptr;
+    std::coroutine_handle<> handle;
+};
+
+// Resumes woken coroutines one after another on this thread rather than
+// inside each other, so a chain of wake-ups can't grow the stack.
+inline void resume_later(Waiter *waiter) {
+    struct Queue {
+        Waiter *head = nullptr;
+        Waiter **tail = &head;
+        bool draining = false;
+    };
+    static thread_local Queue queue;
+    waiter->next = nullptr;
+    *queue.tail = waiter;
+    queue.tail = &waiter->next;
+    if (queue.draining)
+        return;
+    queue.draining = true;
+    while (Waiter *w = queue.head) {
+        queue.head = w->next;
+        if (!queue.head)
+            queue.tail = &queue.head;
+        w->handle.resume(); // w is gone once this returns
+    }
+    queue.draining = false;
+}
+
+template <typename W>
+class WaiterList {
+    W *head = nullptr;
+    W *tail = nullptr;
+
+  public:
+    void push_back(W *w) {
+        w->next = nullptr;
+        if (tail)
+            tail->next = w;
+        else
+            head = w;
+        tail = w;
+    }
+    W *front() const { return head; }
+    void pop_front() {
+        head = static_cast<W *>(head->next);
+        if (!head)
+            tail = nullptr;
+    }
+};
+
+template <typename T>
+class channel {
+  public:
+    class SendAwaiter : public Waiter {
+        friend class channel;
+        channel &ch;
+        T value;
+
+      public:
+        SendAwaiter(channel &ch, T value) : ch(ch), value(std::move(value)) {}
+
+        bool await_ready() {
+            if (!ch.ring.try_push(value))
+                return false;
+            ch.wake_receiver();
+            return true;
+        }
+        bool await_suspend(std::coroutine_handle<> h) {
+            handle = h;
+            std::unique_lock lock(ch.mutex);
+            // the increment is ordered against a receiver's check in wake_sender()
+            ch.waiting_senders.fetch_add(1, std::memory_order_acq_rel);
+            if (ch.ring.try_push(value)) {
+                ch.waiting_senders.fetch_sub(1, std::memory_order_relaxed);
+                lock.unlock();
+                ch.wake_receiver();
+                return false;
+            }
+            ch.senders.push_back(this);
+            return true;
+        }
+        void await_resume() {}
+    };
+
+    class RecvAwaiter : public Waiter {
+        friend class channel;
+        channel &ch;
+        std::optional<T> item;
+
+      public:
+        explicit RecvAwaiter(channel &ch) : ch(ch) {}
+
+        bool await_ready() {
+            item = ch.ring.try_pop();
+            if (!item)
+                return false;
+            ch.wake_sender();
+            return true;
+        }
+        bool await_suspend(std::coroutine_handle<> h) {
+            handle = h;
+            std::unique_lock lock(ch.mutex);
+            ch.waiting_receivers.fetch_add(1, std::memory_order_acq_rel);
+            item = ch.ring.try_pop();
+            if (item || ch.closed) {
+                ch.waiting_receivers.fetch_sub(1, std::memory_order_relaxed);
+                lock.unlock();
+                if (item)
+                    ch.wake_sender();
+                return false;
+            }
+            ch.receivers.push_back(this);
+            return true;
+        }
+        // nullopt once the channel is closed and drained
+        std::optional<T> await_resume() { return std::move(item); }
+    };
+
+    explicit channel(std::size_t capacity) : ring(capacity) {}
+    channel(const channel &) = delete;
+    channel &operator=(const channel &) = delete;
+
+    SendAwaiter send(T value) { return SendAwaiter{*this, std::move(value)}; }
+    RecvAwaiter recv() { return RecvAwaiter{*this}; }
+
+    // Receivers get nullopt once the ring is empty. Every send must have
+    // completed before this is called.
+    void close() {
+        std::unique_lock lock(mutex);
+        closed = true;
+        WaiterList<RecvAwaiter> woken = receivers;
+        receivers = {};
+        waiting_receivers.store(0, std::memory_order_relaxed);
+        lock.unlock();
+        while (RecvAwaiter *r = woken.front()) {
+            woken.pop_front();
+            resume_later(r);
+        }
+    }
+
+  private:
+    MpmcRing<T> ring;
+    // Only touched by coroutines that have to park and by whoever wakes them.
+    SpinLock mutex;
+    WaiterList<SendAwaiter> senders;
+    WaiterList<RecvAwaiter> receivers;
+    bool closed = false;
+    // Parked counts, so the fast path can tell there is nobody to wake
+    // without taking the lock. They are checked with a read-modify-write so
+    // that a waker and a coroutine about to park can't both miss each other:
+    // one of the two RMWs comes second and sees the other's side.
+    alignas(64) std::atomic<std::size_t> waiting_senders{0};
+    alignas(64) std::atomic<std::size_t> waiting_receivers{0};
+
+    // An item just went in: hand one to a parked receiver, if any.
+    void wake_receiver() {
+        if (waiting_receivers.fetch_add(0, std::memory_order_acq_rel) == 0)
+            return;
+        std::unique_lock lock(mutex);
+        RecvAwaiter *r = receivers.front();
+        if (!r || !(r->item = ring.try_pop()))
+            return;
+        receivers.pop_front();
+        waiting_receivers.fetch_sub(1, std::memory_order_relaxed);
+        lock.unlock();
+        resume_later(r);
+        wake_sender();
+    }
+
+    // A slot just came free: put a parked sender's value in it, if any.
+    void wake_sender() {
+        if (waiting_senders.fetch_add(0, std::memory_order_acq_rel) == 0)
+            return;
+        std::unique_lock lock(mutex);
+        SendAwaiter *s = senders.front();
+        if (!s || !ring.try_push(s->value))
+            return;
+        senders.pop_front();
+        waiting_senders.fetch_sub(1, std::memory_order_relaxed);
+        lock.unlock();
+        resume_later(s);
+        wake_receiver();
+    }
+};
+
+// A coroutine nobody waits for: started by resuming it, and it frees its own
+// frame when it finishes.
+struct Task {
+    struct promise_type {
+        Task get_return_object() {
+            return Task{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+    std::coroutine_handle<promise_type> handle;
+};
+
+// ----------------------------------------------------------------------
+// Demo: two producers share a channel too small for either to run far ahead.
+
+Task produce(channel<int> &ch, int first, int last, int step, int &running) {
+    for (int i = first; i <= last; i += step)
+        co_await ch.send(i);
+    if (--running == 0)
+        ch.close();
+}
+
+Task print_fizzbuzz(channel<int> &ch) {
+    while (std::optional<int> n = co_await ch.recv()) {
+        std::string text;
+        if (*n % 3 == 0)
+            text += "Fizz";
+        if (*n % 5 == 0)
+            text += "Buzz";
+        std::cout << (text.empty() ? std::to_string(*n) : text) << std::endl;
+    }
+}
+
+// ----------------------------------------------------------------------
+// Benchmark.
+
+// The baseline: a bounded queue threads block on.
+template <typename T>
+class BlockingQueue {
+    std::mutex mutex;
+    std::condition_variable not_full, not_empty;
+    std::deque<T> items;
+    const std::size_t capacity;
+    bool closed = false;
+
+  public:
+    explicit BlockingQueue(std::size_t capacity) : capacity(capacity) {}
+
+    void push(T value) {
+        std::unique_lock lock(mutex);
+        not_full.wait(lock, [&] { return items.size() < capacity; });
+        items.push_back(std::move(value));
+        not_empty.notify_one();
+    }
+    std::optional<T> pop() {
+        std::unique_lock lock(mutex);
+        not_empty.wait(lock, [&] { return !items.empty() || closed; });
+        if (items.empty())
+            return std::nullopt;
+        std::optional<T> value{std::move(items.front())};
+        items.pop_front();
+        not_full.notify_one();
+        return value;
+    }
+    void close() {
+        std::lock_guard lock(mutex);
+        closed = true;
+        not_empty.notify_all();
+    }
+};
+
+struct Tally {
+    std::atomic<long> sum{0};
+    std::atomic<int> producers_left;
+};
+
+Task bench_producer(channel<long> &ch, long first, long count, Tally &tally) {
+    for (long i = first; i < first + count; i++)
+        co_await ch.send(i);
+    if (tally.producers_left.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        ch.close();
+}
+
+Task bench_consumer(channel<long> &ch, Tally &tally) {
+    long sum = 0;
+    while (std::optional<long> v = co_await ch.recv())
+        sum += *v;
+    tally.sum.fetch_add(sum, std::memory_order_relaxed);
+}
+
+// Items/s, or -1 if items went missing. Every producer and consumer starts on
+// a thread of its own; coroutines continue on whichever thread wakes them.
+double bench_channel(int producers, int consumers, long items, std::size_t capacity) {
+    channel<long> ch(capacity);
+    Tally tally;
+    tally.producers_left = producers;
+    const long per_producer = items / producers;
+    std::vector<std::coroutine_handle<>> starts;
+    for (int c = 0; c < consumers; c++)
+        starts.push_back(bench_consumer(ch, tally).handle);
+    for (int p = 0; p < producers; p++)
+        starts.push_back(bench_producer(ch, p * per_producer, per_producer, tally).handle);
+
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (auto h : starts)
+        threads.emplace_back([h] { h.resume(); });
+    for (auto &t : threads)
+        t.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+
+    const long n = per_producer * producers;
+    if (tally.sum != n * (n - 1) / 2)
+        return -1;
+    return n / elapsed.count();
+}
+
+double bench_blocking(int producers, int consumers, long items, std::size_t capacity) {
+    BlockingQueue<long> queue(capacity);
+    Tally tally;
+    tally.producers_left = producers;
+    const long per_producer = items / producers;
+
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int c = 0; c < consumers; c++) {
+        threads.emplace_back([&] {
+            long sum = 0;
+            while (std::optional<long> v = queue.pop())
+                sum += *v;
+            tally.sum.fetch_add(sum, std::memory_order_relaxed);
+        });
+    }
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&, p] {
+            for (long i = p * per_producer; i < (p + 1) * per_producer; i++)
+                queue.push(i);
+            if (tally.producers_left.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                queue.close();
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+
+    const long n = per_producer * producers;
+    if (tally.sum != n * (n - 1) / 2)
+        return -1;
+    return n / elapsed.count();
+}
+
+int main() {
+    {
+        channel<int> ch(2);
+        int running = 2;
+        Task odd = produce(ch, 1, 15, 2, running);
+        Task even = produce(ch, 2, 15, 2, running);
+        Task consumer = print_fizzbuzz(ch);
+        odd.handle.resume();
+        even.handle.resume();
+        consumer.handle.resume();
+    }
+
+    const long items = 2000000;
+    const std::size_t capacity = 1024;
+    for (int n : {1, 4, 16}) {
+        const double coroutines = bench_channel(n, n, items, capacity);
+        const double blocking = bench_blocking(n, n, items, capacity);
+        if (coroutines < 0 || blocking < 0) {
+            std::cout << "items went missing" << std::endl;
+            return 1;
+        }
+        std::cout << std::setw(2) << n << " producers x " << std::setw(2) << n << " consumers: "
+                  << "channel " << static_cast<std::size_t>(coroutines) << " items/s, "
+                  << "mutex+condvar " << static_cast<std::size_t>(blocking) << " items/s" << std::endl;
+    }
+}
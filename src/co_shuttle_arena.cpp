@@ -0,0 +1,415 @@
+// The co_shuttle FizzBuzz pipeline with allocator-aware coroutine frames.
+// A stage called with std::allocator_arg and an allocator (or a
+// std::pmr::memory_resource *) as its leading arguments gets its frame from
+// that allocator, so a whole pipeline can be built in one monotonic arena,
+// next to each other in memory, and released in one go when it is done.
+// Stages called without one use the global heap as before.
+//
+// The benchmark runs thousands of pipelines round-robin with their frames
+// either scattered across a fragmented heap or packed into an arena (on
+// huge pages where the kernel allows), and reports time and, where
+// perf_event_open is permitted, cache misses per element.
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <optional>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+struct Value {
+    int number;
+    std::vector<std::string> fizzes;
+};
+
+// Frames are laid out as [coroutine frame | deallocate | allocator copy]:
+// operator delete only gets the frame size back, so the type-erased
+// deallocate function goes at an offset it can work out from that alone, and
+// it knows where its own allocator copy is.
+class FrameAllocator {
+    using Deallocate = void (*)(void *frame, std::size_t size);
+    struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) Block {
+        std::byte bytes[__STDCPP_DEFAULT_NEW_ALIGNMENT__];
+    };
+
+    static constexpr std::size_t align_up(std::size_t n, std::size_t alignment) {
+        return (n + alignment - 1) & ~(alignment - 1);
+    }
+    static std::size_t deallocate_offset(std::size_t size) {
+        return align_up(size, alignof(Deallocate));
+    }
+    template <typename Alloc>
+    static std::size_t allocator_offset(std::size_t size) {
+        return align_up(deallocate_offset(size) + sizeof(Deallocate), alignof(Alloc));
+    }
+    template <typename Alloc>
+    static std::size_t blocks(std::size_t size) {
+        return (allocator_offset<Alloc>(size) + sizeof(Alloc) + sizeof(Block) - 1) / sizeof(Block);
+    }
+
+  public:
+    template <typename Alloc>
+    static void *allocate(const Alloc &alloc, std::size_t size) {
+        using Traits = typename std::allocator_traits<Alloc>::template rebind_traits<Block>;
+        static_assert(alignof(Alloc) <= alignof(Block));
+        typename Traits::allocator_type block_alloc(alloc);
+        auto *frame = reinterpret_cast<std::byte *>(Traits::allocate(block_alloc, blocks<Alloc>(size)));
+        *reinterpret_cast<Deallocate *>(frame + deallocate_offset(size)) = [](void *p, std::size_t size) {
+            auto *frame = static_cast<std::byte *>(p);
+            Alloc *stored = std::launder(reinterpret_cast<Alloc *>(frame + allocator_offset<Alloc>(size)));
+            typename Traits::allocator_type block_alloc(std::move(*stored));
+            stored->~Alloc();
+            Traits::deallocate(block_alloc, reinterpret_cast<Block *>(frame), blocks<Alloc>(size));
+        };
+        ::new (frame + allocator_offset<Alloc>(size)) Alloc(alloc);
+        return frame;
+    }
+
+    static void deallocate(void *frame, std::size_t size) {
+        (*reinterpret_cast<Deallocate *>(static_cast<std::byte *>(frame) + deallocate_offset(size)))(frame, size);
+    }
+};
+
+class UserFacing {
+  public:
+    class promise_type;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    class InputAwaiter {
+        promise_type *promise;
+      public:
+        InputAwaiter(promise_type *);
+
+        bool await_ready() { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<>);
+        std::optional<Value> await_resume();
+    };
+
+    class OutputAwaiter {
+        promise_type *promise;
+      public:
+        OutputAwaiter(promise_type *);
+
+        bool await_ready() { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<>);
+        void await_resume() {}
+    };
+
+    class promise_type {
+        promise_type *consumer = nullptr;
+
+        // Prevent accidentally copying the promise type
+        promise_type(const promise_type &) = delete;
+        promise_type &operator=(const promise_type &) = delete;
+
+      public:
+        std::optional<Value> yielded_value;
+
+        promise_type() = default;
+
+        // the frame comes from the allocator after std::allocator_arg, if any
+        static void *operator new(std::size_t size) {
+            return FrameAllocator::allocate(std::allocator<std::byte>{}, size);
+        }
+        template <typename... Args>
+        static void *operator new(std::size_t size, std::allocator_arg_t, std::pmr::memory_resource *resource,
+                                  Args &&...) {
+            return FrameAllocator::allocate(std::pmr::polymorphic_allocator<std::byte>(resource), size);
+        }
+        template <typename Alloc, typename... Args>
+            requires(!std::is_convertible_v<const Alloc &, std::pmr::memory_resource *>)
+        static void *operator new(std::size_t size, std::allocator_arg_t, const Alloc &alloc, Args &&...) {
+            return FrameAllocator::allocate(alloc, size);
+        }
+        static void operator delete(void *frame, std::size_t size) {
+            FrameAllocator::deallocate(frame, size);
+        }
+
+        UserFacing get_return_object() {
+            auto handle = handle_type::from_promise(*this);
+            return UserFacing{handle};
+        }
+        std::suspend_always initial_suspend() { return {}; }
+        void return_void() {}
+        void unhandled_exception() {}
+        std::suspend_always final_suspend() noexcept { return {}; }
+
+        OutputAwaiter yield_value(Value value) {
+            yielded_value = value;
+            return OutputAwaiter{consumer};
+        }
+
+        InputAwaiter await_transform(UserFacing &uf);
+    };
+
+  private:
+    handle_type handle;
+
+    UserFacing(handle_type handle) : handle(handle) {}
+
+    UserFacing(const UserFacing &) = delete;
+    UserFacing &operator=(const UserFacing &) = delete;
+
+  public:
+    std::optional<Value> next_value() {
+        auto &promise = handle.promise();
+        promise.yielded_value = std::nullopt;
+        if (!handle.done())
+            handle.resume();
+        return promise.yielded_value;
+    }
+
+    UserFacing(UserFacing &&rhs) : handle(rhs.handle) {
+        rhs.handle = nullptr;
+    }
+    UserFacing &operator=(UserFacing &&rhs) {
+        if (handle)
+            handle.destroy();
+        handle = rhs.handle;
+        rhs.handle = nullptr;
+        return *this;
+    }
+    ~UserFacing() {
+        if (handle)
+            handle.destroy();
+    }
+};
+
+// ----------------------------------------------------------------------
+// Out-of-line method definitions, which couldn't be written until
+// all the types were complete.
+
+UserFacing::InputAwaiter::InputAwaiter(promise_type *promise)
+    : promise(promise) {}
+UserFacing::OutputAwaiter::OutputAwaiter(promise_type *promise)
+    : promise(promise) {}
+
+std::coroutine_handle<>
+UserFacing::InputAwaiter::await_suspend(std::coroutine_handle<>) {
+    promise->yielded_value = std::nullopt;
+    return handle_type::from_promise(*promise);
+}
+std::coroutine_handle<>
+UserFacing::OutputAwaiter::await_suspend(std::coroutine_handle<>) {
+    if (promise)
+        return handle_type::from_promise(*promise);
+    else
+        return std::noop_coroutine();
+}
+
+std::optional<Value> UserFacing::InputAwaiter::await_resume() {
+    return promise->yielded_value;
+}
+
+auto UserFacing::promise_type::await_transform(UserFacing &uf) -> InputAwaiter {
+    promise_type &producer = uf.handle.promise();
+    producer.consumer = this;
+    return InputAwaiter{&producer};
+}
+
+// ----------------------------------------------------------------------
+// Pipeline stages. Each takes an optional std::allocator_arg, allocator
+// pair in front, which only operator new looks at.
+
+template <typename Alloc>
+UserFacing generate_numbers(std::allocator_arg_t, const Alloc &, int limit) {
+    for (int i = 1; i <= limit; i++) {
+        Value v;
+        v.number = i;
+        co_yield v;
+    }
+}
+UserFacing generate_numbers(int limit) {
+    return generate_numbers(std::allocator_arg, std::allocator<std::byte>{}, limit);
+}
+
+template <typename Alloc>
+UserFacing check_multiple(std::allocator_arg_t, const Alloc &, UserFacing source, int divisor, std::string fizz) {
+    while (std::optional<Value> vopt = co_await source) {
+        Value &v = *vopt;
+
+        if (v.number % divisor == 0)
+            v.fizzes.push_back(fizz);
+
+        co_yield std::move(v);
+    }
+}
+UserFacing check_multiple(UserFacing source, int divisor, std::string fizz) {
+    return check_multiple(std::allocator_arg, std::allocator<std::byte>{}, std::move(source), divisor, std::move(fizz));
+}
+
+void print(const Value &v) {
+    if (v.fizzes.empty()) {
+        std::cout << v.number << std::endl;
+    } else {
+        for (auto &fizz: v.fizzes)
+            std::cout << fizz;
+        std::cout << std::endl;
+    }
+}
+
+// ----------------------------------------------------------------------
+// Benchmark.
+
+// Anonymous memory for an arena, on transparent huge pages if the kernel
+// will give us them.
+class HugePageBuffer {
+    void *data = nullptr;
+    std::size_t size = 0;
+
+  public:
+    explicit HugePageBuffer(std::size_t bytes) {
+#ifdef __linux__
+        size = (bytes + (2u << 20) - 1) & ~std::size_t((2u << 20) - 1);
+        void *p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            size = 0;
+            return;
+        }
+        data = p;
+#ifdef MADV_HUGEPAGE
+        ::madvise(data, size, MADV_HUGEPAGE);
+#endif
+#else
+        (void)bytes;
+#endif
+    }
+    ~HugePageBuffer() {
+#ifdef __linux__
+        if (data)
+            ::munmap(data, size);
+#endif
+    }
+    HugePageBuffer(const HugePageBuffer &) = delete;
+    HugePageBuffer &operator=(const HugePageBuffer &) = delete;
+
+    void *get() const { return data; }
+    std::size_t bytes() const { return size; }
+};
+
+// Last-level cache misses on this thread, where perf_event_open is allowed.
+class CacheMisses {
+    int fd = -1;
+
+  public:
+    CacheMisses() {
+#ifdef __linux__
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = static_cast<int>(::syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+    ~CacheMisses() {
+#ifdef __linux__
+        if (fd >= 0)
+            ::close(fd);
+#endif
+    }
+    CacheMisses(const CacheMisses &) = delete;
+    CacheMisses &operator=(const CacheMisses &) = delete;
+
+    explicit operator bool() const { return fd >= 0; }
+    std::uint64_t read() const {
+        std::uint64_t count = 0;
+#ifdef __linux__
+        if (fd >= 0 && ::read(fd, &count, sizeof(count)) != sizeof(count))
+            count = 0;
+#endif
+        return count;
+    }
+};
+
+// `pipelines` chains of generate_numbers and `stages` check_multiple each,
+// pulled one element at a time round-robin so every element walks a
+// different chain's frames. The divisors never divide, so the only per
+// element work is hopping between frames. before_frame runs ahead of every
+// frame allocation and alloc... goes in front of every stage's arguments.
+template <typename BeforeFrame, typename... Alloc>
+void bench(const std::string &name, int pipelines, int stages, int rounds, BeforeFrame before_frame,
+           const Alloc &...alloc) {
+    std::vector<UserFacing> chains;
+    for (int p = 0; p < pipelines; p++) {
+        before_frame();
+        UserFacing c = generate_numbers(alloc..., rounds);
+        for (int s = 0; s < stages; s++) {
+            before_frame();
+            c = check_multiple(alloc..., std::move(c), rounds + 1 + s, "Never");
+        }
+        chains.push_back(std::move(c));
+    }
+
+    CacheMisses misses;
+    const std::uint64_t misses_before = misses.read();
+    long sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+        for (auto &c : chains)
+            sum += c.next_value()->number;
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    const double elements = static_cast<double>(pipelines) * rounds;
+
+    std::cout << std::left << std::setw(20) << name << ": " << std::fixed << std::setprecision(1)
+              << elapsed.count() / elements << " ns/element, ";
+    if (misses)
+        std::cout << (misses.read() - misses_before) / elements << " cache misses/element";
+    else
+        std::cout << "cache misses not available";
+    std::cout << std::endl;
+    if (sum != static_cast<long>(pipelines) * rounds * (rounds + 1) / 2)
+        std::cout << "bad sum " << sum << std::endl;
+}
+
+int main() {
+    {
+        // a whole pipeline in an arena on the stack, freed when it goes
+        std::byte buffer[4096];
+        std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer));
+        UserFacing c = generate_numbers(std::allocator_arg, &arena, 200);
+        c = check_multiple(std::allocator_arg, &arena, std::move(c), 3, "Fizz");
+        c = check_multiple(std::allocator_arg, &arena, std::move(c), 5, "Buzz");
+        while (std::optional<Value> vopt = c.next_value())
+            print(*vopt);
+    }
+
+    const int pipelines = 4096, stages = 8, rounds = 64;
+
+    // the global heap, with unrelated allocations of random sizes between
+    // the frames the way a long-running program's heap would have them
+    std::mt19937 rng(1);
+    std::vector<std::unique_ptr<char[]>> junk;
+    bench("scattered frames", pipelines, stages, rounds,
+          [&] { junk.emplace_back(new char[16 + rng() % 512]); });
+    junk.clear();
+
+    {
+        std::pmr::monotonic_buffer_resource arena;
+        bench("arena frames", pipelines, stages, rounds, [] {}, std::allocator_arg,
+              static_cast<std::pmr::memory_resource *>(&arena));
+    }
+    {
+        HugePageBuffer pages(static_cast<std::size_t>(pipelines) * (stages + 1) * 512);
+        std::pmr::monotonic_buffer_resource arena(pages.get(), pages.bytes());
+        bench("arena on huge pages", pipelines, stages, rounds, [] {}, std::allocator_arg,
+              static_cast<std::pmr::memory_resource *>(&arena));
+    }
+}
@@ -0,0 +1,210 @@
+// The co_shuttle FizzBuzz pipeline in batched mode: stages co_yield a block of
+// Values instead of a single one, so the two symmetric transfers per stage are
+// paid once per block rather than once per number.
+#include <algorithm>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+struct Value {
+    int number;
+    std::vector<std::string> fizzes;
+};
+
+// A block of values owned by the stage that produced it. It stays valid until
+// the consumer asks that stage for the next block, so downstream stages can
+// edit it in place and pass the same block on without copying.
+using Batch = std::span<Value>;
+
+class UserFacing {
+  public:
+    class promise_type;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    class InputAwaiter {
+        promise_type *promise;
+      public:
+        InputAwaiter(promise_type *);
+
+        bool await_ready() { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<>);
+        std::optional<Batch> await_resume();
+    };
+
+    class OutputAwaiter {
+        promise_type *promise;
+      public:
+        OutputAwaiter(promise_type *);
+
+        bool await_ready() { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<>);
+        void await_resume() {}
+    };
+
+    class promise_type {
+        promise_type *consumer = nullptr;
+
+        // Prevent accidentally copying the promise type
+        promise_type(const promise_type &) = delete;
+        promise_type &operator=(const promise_type &) = delete;
+
+      public:
+        std::optional<Batch> yielded_value;
+
+        promise_type() = default;
+
+        UserFacing get_return_object() {
+            auto handle = handle_type::from_promise(*this);
+            return UserFacing{handle};
+        }
+        std::suspend_always initial_suspend() { return {}; }
+        void return_void() {}
+        void unhandled_exception() {}
+        std::suspend_always final_suspend() noexcept { return {}; }
+
+        OutputAwaiter yield_value(Batch batch) {
+            yielded_value = batch;
+            return OutputAwaiter{consumer};
+        }
+
+        InputAwaiter await_transform(UserFacing &uf);
+    };
+
+  private:
+    handle_type handle;
+
+    UserFacing(handle_type handle) : handle(handle) {}
+
+    UserFacing(const UserFacing &) = delete;
+    UserFacing &operator=(const UserFacing &) = delete;
+
+  public:
+    std::optional<Batch> next_batch() {
+        auto &promise = handle.promise();
+        promise.yielded_value = std::nullopt;
+        if (!handle.done())
+            handle.resume();
+        return promise.yielded_value;
+    }
+
+    // Item-at-a-time view for sinks that don't care about batching.
+    template <typename F>
+    void for_each_value(F f) {
+        while (std::optional<Batch> batch = next_batch())
+            for (Value &v : *batch)
+                f(v);
+    }
+
+    UserFacing(UserFacing &&rhs) : handle(rhs.handle) {
+        rhs.handle = nullptr;
+    }
+    UserFacing &operator=(UserFacing &&rhs) {
+        if (handle)
+            handle.destroy();
+        handle = rhs.handle;
+        rhs.handle = nullptr;
+        return *this;
+    }
+    ~UserFacing() {
+        if (handle)
+            handle.destroy();
+    }
+};
+
+// ----------------------------------------------------------------------
+// Out-of-line method definitions, which couldn't be written until
+// all the types were complete.
+
+UserFacing::InputAwaiter::InputAwaiter(promise_type *promise)
+    : promise(promise) {}
+UserFacing::OutputAwaiter::OutputAwaiter(promise_type *promise)
+    : promise(promise) {}
+
+std::coroutine_handle<>
+UserFacing::InputAwaiter::await_suspend(std::coroutine_handle<>) {
+    promise->yielded_value = std::nullopt;
+    return handle_type::from_promise(*promise);
+}
+std::coroutine_handle<>
+UserFacing::OutputAwaiter::await_suspend(std::coroutine_handle<>) {
+    if (promise)
+        return handle_type::from_promise(*promise);
+    else
+        return std::noop_coroutine();
+}
+
+std::optional<Batch> UserFacing::InputAwaiter::await_resume() {
+    return promise->yielded_value;
+}
+
+auto UserFacing::promise_type::await_transform(UserFacing &uf) -> InputAwaiter {
+    promise_type &producer = uf.handle.promise();
+    producer.consumer = this;
+    return InputAwaiter{&producer};
+}
+
+// ----------------------------------------------------------------------
+// Batched versions of the co_shuttle stages.
+
+// A batch size of 0 is taken as 1; it would otherwise yield empty batches forever.
+UserFacing generate_numbers(int limit, std::size_t batch_size) {
+    batch_size = std::max<std::size_t>(batch_size, 1);
+    std::vector<Value> block(batch_size);
+    int i = 1;
+    while (i <= limit) {
+        std::size_t n = 0;
+        for (; n < batch_size && i <= limit; n++, i++) {
+            block[n].number = i;
+            block[n].fizzes.clear();
+        }
+        co_yield Batch{block.data(), n};
+    }
+}
+
+UserFacing check_multiple(UserFacing source, int divisor, std::string fizz) {
+    while (std::optional<Batch> batch = co_await source) {
+        for (Value &v : *batch) {
+            if (v.number % divisor == 0)
+                v.fizzes.push_back(fizz);
+        }
+        co_yield *batch;
+    }
+}
+
+void bench(std::size_t batch_size, int limit) {
+    std::size_t fizzes = 0;
+    auto start = std::chrono::steady_clock::now();
+    UserFacing c = generate_numbers(limit, batch_size);
+    c = check_multiple(std::move(c), 3, "Fizz");
+    c = check_multiple(std::move(c), 5, "Buzz");
+    c.for_each_value([&](const Value &v) { fizzes += v.fizzes.size(); });
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "batch " << std::setw(5) << batch_size << ": "
+              << static_cast<std::size_t>(limit / elapsed.count()) << " items/s"
+              << " (" << fizzes << " fizzes)" << std::endl;
+}
+
+int main() {
+    UserFacing c = generate_numbers(200, 16);
+    c = check_multiple(std::move(c), 3, "Fizz");
+    c = check_multiple(std::move(c), 5, "Buzz");
+    c.for_each_value([](const Value &v) {
+        if (v.fizzes.empty()) {
+            std::cout << v.number << std::endl;
+        } else {
+            for (auto &fizz: v.fizzes)
+                std::cout << fizz;
+            std::cout << std::endl;
+        }
+    });
+
+    // batch size 1 is the original one-number-per-transfer pipeline
+    for (std::size_t batch_size : {1, 4, 16, 64, 256, 1024})
+        bench(batch_size, 5000000);
+}
@@ -0,0 +1,240 @@
+// The co_shuttle FizzBuzz pipeline with cooperative cancellation: a consumer
+// that has seen enough calls request_stop(), the request travels up the chain
+// of producers, and every stage stops at its next suspension point instead of
+// running until generate_numbers reaches its limit.
+#include <chrono>
+#include <coroutine>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+// The value type we're going to pass along our coroutine chain. This
+// is wrapped in a further std::optional so that we can signal the end
+// of the data stream by delivering std::nullopt.
+struct Value {
+    // Our example case is FizzBuzz, so our value contains the current
+    // integer in our count, and a string containing the fizzes and
+    // buzzes we've accumulated so far.
+    int number;
+    std::vector<std::string> fizzes;
+};
+
+class UserFacing {
+  public:
+    class promise_type;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    class InputAwaiter {
+        UserFacing *source;
+        promise_type *promise;
+      public:
+        InputAwaiter(UserFacing *);
+
+        // a cancelled chain reads as end-of-stream without resuming the producer
+        bool await_ready() { return promise->stop_requested; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<>);
+        std::optional<Value> await_resume();
+    };
+
+    class OutputAwaiter {
+        promise_type *promise;
+      public:
+        OutputAwaiter(promise_type *);
+
+        bool await_ready() { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<>);
+        void await_resume() {}
+    };
+
+    class promise_type {
+        promise_type *consumer = nullptr;
+        promise_type *producer = nullptr;
+
+        // Prevent accidentally copying the promise type
+        promise_type(const promise_type &) = delete;
+        promise_type &operator=(const promise_type &) = delete;
+
+      public:
+        std::optional<Value> yielded_value;
+        bool stop_requested = false;
+        static inline int live_frames = 0;
+
+        promise_type() { live_frames++; }
+        ~promise_type() { live_frames--; }
+
+        // Mark this stage and everything upstream of it as cancelled.
+        void request_stop() {
+            for (promise_type *p = this; p && !p->stop_requested; p = p->producer)
+                p->stop_requested = true;
+        }
+
+        UserFacing get_return_object() {
+            auto handle = handle_type::from_promise(*this);
+            return UserFacing{handle};
+        }
+        std::suspend_always initial_suspend() { return {}; }
+        void return_void() {}
+        void unhandled_exception() {}
+        std::suspend_always final_suspend() noexcept { return {}; }
+
+        OutputAwaiter yield_value(Value value) {
+            yielded_value = value;
+            return OutputAwaiter{consumer};
+        }
+
+        InputAwaiter await_transform(UserFacing &uf);
+    };
+
+  private:
+    handle_type handle;
+
+    UserFacing(handle_type handle) : handle(handle) {}
+
+    UserFacing(const UserFacing &) = delete;
+    UserFacing &operator=(const UserFacing &) = delete;
+
+  public:
+    std::optional<Value> next_value() {
+        auto &promise = handle.promise();
+        promise.yielded_value = std::nullopt;
+        if (!handle.done() && !promise.stop_requested)
+            handle.resume();
+        return promise.yielded_value;
+    }
+
+    // Cancel the chain from the consumer end. The last stage is resumed once
+    // so that it reaches its next co_await, which destroys its source and
+    // with it every frame further up, each at the co_yield it last suspended
+    // in, and then reads as end-of-stream.
+    void request_stop() {
+        auto &promise = handle.promise();
+        promise.request_stop();
+        promise.yielded_value = std::nullopt;
+        if (!handle.done())
+            handle.resume();
+    }
+
+    UserFacing(UserFacing &&rhs) : handle(rhs.handle) {
+        rhs.handle = nullptr;
+    }
+    UserFacing &operator=(UserFacing &&rhs) {
+        if (handle)
+            handle.destroy();
+        handle = rhs.handle;
+        rhs.handle = nullptr;
+        return *this;
+    }
+    ~UserFacing() {
+        if (handle)
+            handle.destroy();
+    }
+};
+
+// ----------------------------------------------------------------------
+// Out-of-line method definitions, which couldn't be written until
+// all the types were complete.
+
+UserFacing::InputAwaiter::InputAwaiter(UserFacing *source)
+    : source(source), promise(&source->handle.promise()) {}
+UserFacing::OutputAwaiter::OutputAwaiter(promise_type *promise)
+    : promise(promise) {}
+
+std::coroutine_handle<>
+UserFacing::InputAwaiter::await_suspend(std::coroutine_handle<>) {
+    promise->yielded_value = std::nullopt;
+    return handle_type::from_promise(*promise);
+}
+std::coroutine_handle<>
+UserFacing::OutputAwaiter::await_suspend(std::coroutine_handle<> h) {
+    // once cancelled, a yielding stage stays parked until its owner destroys it
+    if (promise && !handle_type::from_address(h.address()).promise().stop_requested)
+        return handle_type::from_promise(*promise);
+    else
+        return std::noop_coroutine();
+}
+
+std::optional<Value> UserFacing::InputAwaiter::await_resume() {
+    if (promise->stop_requested) {
+        // a coroutine's parameters outlive its body, so free the upstream
+        // frames here rather than when this stage's own frame goes away
+        source->handle.destroy();
+        source->handle = nullptr;
+        return std::nullopt;
+    }
+    return promise->yielded_value;
+}
+
+auto UserFacing::promise_type::await_transform(UserFacing &uf) -> InputAwaiter {
+    promise_type &producer = uf.handle.promise();
+    producer.consumer = this;
+    this->producer = &producer;
+    if (stop_requested)
+        producer.request_stop();
+    return InputAwaiter{&uf};
+}
+
+// ----------------------------------------------------------------------
+// Now for the example code that actually makes and uses some coroutines.
+
+UserFacing generate_numbers(int limit) {
+    for (int i = 1; i <= limit; i++) {
+        Value v;
+        v.number = i;
+        co_yield v;
+    }
+}
+
+UserFacing check_multiple(UserFacing source, int divisor, std::string fizz) {
+    while (std::optional<Value> vopt = co_await source) {
+        Value &v = *vopt;
+
+        if (v.number % divisor == 0)
+            v.fizzes.push_back(fizz);
+
+        co_yield v;
+    }
+}
+
+void print(const Value &v) {
+    if (v.fizzes.empty()) {
+        std::cout << v.number << std::endl;
+    } else {
+        for (auto &fizz: v.fizzes)
+            std::cout << fizz;
+        std::cout << std::endl;
+    }
+}
+
+// Take the first `wanted` values of a billion-number chain, then cancel it.
+// The whole chain must be gone right after request_stop(), long before
+// generate_numbers could have got anywhere near its limit.
+bool check_cancel(int wanted) {
+    auto start = std::chrono::steady_clock::now();
+    UserFacing c = generate_numbers(1000000000);
+    c = check_multiple(std::move(c), 3, "Fizz");
+    c = check_multiple(std::move(c), 5, "Buzz");
+    int seen = 0;
+    while (std::optional<Value> vopt = c.next_value()) {
+        print(*vopt);
+        if (++seen == wanted)
+            c.request_stop();
+    }
+    const int left = UserFacing::promise_type::live_frames;
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "cancelled after " << seen << " values in " << elapsed.count() << " us, "
+              << left << " frame(s) left" << std::endl;
+    // only the last stage's own frame survives, until `c` goes out of scope
+    return seen == wanted && left == 1 && elapsed < std::chrono::seconds(1);
+}
+
+int main() {
+    if (!check_cancel(10))
+        return 1;
+
+    UserFacing c = generate_numbers(200);
+    c = check_multiple(std::move(c), 3, "Fizz");
+    c = check_multiple(std::move(c), 5, "Buzz");
+    while (std::optional<Value> vopt = c.next_value())
+        print(*vopt);
+}
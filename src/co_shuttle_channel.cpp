@@ -0,0 +1,329 @@
+// The co_shuttle FizzBuzz pipeline, with bounded SPSC channels between stages
+// so that generate_numbers and each check_multiple can run on their own thread.
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+struct Value {
+    int number;
+    std::vector<std::string> fizzes;
+};
+
+// Lock-free single-producer/single-consumer ring. The depth bounds how far the
+// producer can run ahead of the consumer; a full ring is the backpressure.
+template <typename T>
+class SpscChannel {
+    static std::size_t round_up(std::size_t n) {
+        std::size_t cap = 1;
+        while (cap < n)
+            cap <<= 1;
+        return cap;
+    }
+
+    const std::size_t mask;
+    std::unique_ptr<T[]> slots;
+    // each index lives on its own cache line next to the other side's cached copy
+    alignas(64) std::atomic<std::size_t> head{0}; // next slot to read
+    std::size_t cached_tail = 0;
+    alignas(64) std::atomic<std::size_t> tail{0}; // next slot to write
+    std::size_t cached_head = 0;
+
+  public:
+    explicit SpscChannel(std::size_t depth)
+        : mask(round_up(depth) - 1), slots(new T[mask + 1]) {}
+
+    bool try_push(T &value) {
+        const auto t = tail.load(std::memory_order_relaxed);
+        if (t - cached_head > mask) {
+            cached_head = head.load(std::memory_order_acquire);
+            if (t - cached_head > mask)
+                return false;
+        }
+        slots[t & mask] = std::move(value);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T &out) {
+        const auto h = head.load(std::memory_order_relaxed);
+        if (h == cached_tail) {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (h == cached_tail)
+                return false;
+        }
+        out = std::move(slots[h & mask]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+// Spin briefly, then give the core away; stages are expected to be pinned so
+// the spin usually wins.
+inline void backoff(unsigned &spins) {
+    if (++spins < 64)
+        return;
+    spins = 0;
+    std::this_thread::yield();
+}
+
+using ValueChannel = SpscChannel<std::optional<Value>>;
+
+class UserFacing {
+  public:
+    class promise_type;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    class InputAwaiter {
+        promise_type *promise;
+      public:
+        InputAwaiter(promise_type *);
+
+        bool await_ready() { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<>);
+        std::optional<Value> await_resume();
+    };
+
+    class OutputAwaiter {
+        promise_type *promise;
+      public:
+        OutputAwaiter(promise_type *);
+
+        bool await_ready() { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<>);
+        void await_resume() {}
+    };
+
+    // co_await on a channel: the stage owns its thread, so an empty channel is
+    // waited out in place rather than handing the thread to anybody else.
+    class ChannelAwaiter {
+        ValueChannel &channel;
+        std::optional<Value> item;
+      public:
+        ChannelAwaiter(ValueChannel &channel) : channel(channel) {}
+
+        bool await_ready() { return channel.try_pop(item); }
+        bool await_suspend(std::coroutine_handle<>) {
+            unsigned spins = 0;
+            while (!channel.try_pop(item))
+                backoff(spins);
+            return false;
+        }
+        std::optional<Value> await_resume() { return std::move(item); }
+    };
+
+    class promise_type {
+        promise_type *consumer = nullptr;
+
+        // Prevent accidentally copying the promise type
+        promise_type(const promise_type &) = delete;
+        promise_type &operator=(const promise_type &) = delete;
+
+      public:
+        std::optional<Value> yielded_value;
+
+        promise_type() = default;
+
+        UserFacing get_return_object() {
+            auto handle = handle_type::from_promise(*this);
+            return UserFacing{handle};
+        }
+        std::suspend_always initial_suspend() { return {}; }
+        void return_void() {}
+        void unhandled_exception() {}
+        std::suspend_always final_suspend() noexcept { return {}; }
+
+        OutputAwaiter yield_value(Value value) {
+            yielded_value = std::move(value);
+            return OutputAwaiter{consumer};
+        }
+
+        InputAwaiter await_transform(UserFacing &uf);
+        ChannelAwaiter await_transform(ValueChannel &channel) {
+            return ChannelAwaiter{channel};
+        }
+    };
+
+  private:
+    handle_type handle;
+
+    UserFacing(handle_type handle) : handle(handle) {}
+
+    UserFacing(const UserFacing &) = delete;
+    UserFacing &operator=(const UserFacing &) = delete;
+
+  public:
+    std::optional<Value> next_value() {
+        auto &promise = handle.promise();
+        promise.yielded_value = std::nullopt;
+        if (!handle.done())
+            handle.resume();
+        return std::move(promise.yielded_value);
+    }
+
+    UserFacing(UserFacing &&rhs) : handle(rhs.handle) {
+        rhs.handle = nullptr;
+    }
+    UserFacing &operator=(UserFacing &&rhs) {
+        if (handle)
+            handle.destroy();
+        handle = rhs.handle;
+        rhs.handle = nullptr;
+        return *this;
+    }
+    ~UserFacing() {
+        if (handle)
+            handle.destroy();
+    }
+};
+
+// ----------------------------------------------------------------------
+// Out-of-line method definitions, which couldn't be written until
+// all the types were complete.
+
+UserFacing::InputAwaiter::InputAwaiter(promise_type *promise)
+    : promise(promise) {}
+UserFacing::OutputAwaiter::OutputAwaiter(promise_type *promise)
+    : promise(promise) {}
+
+std::coroutine_handle<>
+UserFacing::InputAwaiter::await_suspend(std::coroutine_handle<>) {
+    promise->yielded_value = std::nullopt;
+    return handle_type::from_promise(*promise);
+}
+std::coroutine_handle<>
+UserFacing::OutputAwaiter::await_suspend(std::coroutine_handle<>) {
+    if (promise)
+        return handle_type::from_promise(*promise);
+    else
+        return std::noop_coroutine();
+}
+
+std::optional<Value> UserFacing::InputAwaiter::await_resume() {
+    return std::move(promise->yielded_value);
+}
+
+auto UserFacing::promise_type::await_transform(UserFacing &uf) -> InputAwaiter {
+    promise_type &producer = uf.handle.promise();
+    producer.consumer = this;
+    return InputAwaiter{&producer};
+}
+
+// ----------------------------------------------------------------------
+// Pipeline stages.
+
+UserFacing generate_numbers(int limit) {
+    for (int i = 1; i <= limit; i++) {
+        Value v;
+        v.number = i;
+        co_yield v;
+    }
+}
+
+UserFacing check_multiple(UserFacing source, int divisor, std::string fizz) {
+    while (std::optional<Value> vopt = co_await source) {
+        Value &v = *vopt;
+
+        if (v.number % divisor == 0)
+            v.fizzes.push_back(fizz);
+
+        co_yield std::move(v);
+    }
+}
+
+// Downstream end of a channel: turns it back into an ordinary stage.
+UserFacing receive(ValueChannel &channel) {
+    while (std::optional<Value> vopt = co_await channel)
+        co_yield std::move(*vopt);
+}
+
+// Upstream end of a channel: drains a stage into it, nullopt marks the end.
+void send_all(UserFacing source, ValueChannel &channel) {
+    unsigned spins = 0;
+    std::optional<Value> vopt;
+    do {
+        vopt = source.next_value();
+        while (!channel.try_push(vopt))
+            backoff(spins);
+    } while (vopt);
+}
+
+void pin_to_core(std::thread &thread, unsigned core) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core % std::max(1u, std::thread::hardware_concurrency()), &set);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#else
+    (void)thread;
+    (void)core;
+#endif
+}
+
+// Run generate_numbers and each check_multiple on its own pinned thread,
+// connected by channels of the given depth, and consume on the caller.
+template <typename Sink>
+void run_parallel(int limit, std::size_t depth, Sink sink) {
+    ValueChannel numbers(depth), fizzed(depth), buzzed(depth);
+    std::vector<std::thread> stages;
+    stages.emplace_back([&] { send_all(generate_numbers(limit), numbers); });
+    stages.emplace_back([&] { send_all(check_multiple(receive(numbers), 3, "Fizz"), fizzed); });
+    stages.emplace_back([&] { send_all(check_multiple(receive(fizzed), 5, "Buzz"), buzzed); });
+    for (unsigned i = 0; i < stages.size(); i++)
+        pin_to_core(stages[i], i + 1);
+
+    UserFacing c = receive(buzzed);
+    while (std::optional<Value> vopt = c.next_value())
+        sink(*vopt);
+    for (auto &t : stages)
+        t.join();
+}
+
+template <typename Sink>
+void run_serial(int limit, Sink sink) {
+    UserFacing c = generate_numbers(limit);
+    c = check_multiple(std::move(c), 3, "Fizz");
+    c = check_multiple(std::move(c), 5, "Buzz");
+    while (std::optional<Value> vopt = c.next_value())
+        sink(*vopt);
+}
+
+void print(const Value &v) {
+    if (v.fizzes.empty()) {
+        std::cout << v.number << std::endl;
+    } else {
+        for (auto &fizz: v.fizzes)
+            std::cout << fizz;
+        std::cout << std::endl;
+    }
+}
+
+template <typename Run>
+void bench(const std::string &name, int limit, Run run) {
+    std::size_t fizzes = 0;
+    auto start = std::chrono::steady_clock::now();
+    run([&](const Value &v) { fizzes += v.fizzes.size(); });
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << std::left << std::setw(20) << name << ": " << static_cast<std::size_t>(limit / elapsed.count())
+              << " items/s (" << fizzes << " fizzes)" << std::endl;
+}
+
+int main() {
+    run_parallel(20, 4, print);
+
+    const int limit = 2000000;
+    bench("serial chain", limit, [&](auto sink) { run_serial(limit, sink); });
+    for (std::size_t depth : {16, 256, 4096}) {
+        bench("channels depth " + std::to_string(depth), limit, [&](auto sink) { run_parallel(limit, depth, sink); });
+    }
+}
@@ -0,0 +1,222 @@
+// The co_shuttle FizzBuzz pipeline with a compact Value: instead of a vector
+// of strings, each value carries a few ids into a table of interned labels,
+// so it is trivially copyable, fits in a cache line, and going through a
+// stage allocates nothing. The strings are only looked up at the sink.
+// The pipeline is templated on the value type so the benchmark can run the
+// original vector<string> representation next to it.
+#include "labels.h"
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// Counts every trip to the global heap, for the benchmark.
+static std::size_t heap_allocations = 0;
+
+void *operator new(std::size_t size) {
+    heap_allocations++;
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+struct Value {
+    int number;
+    Labels fizzes;
+};
+static_assert(std::is_trivially_copyable_v<Value>);
+static_assert(sizeof(Value) <= 64);
+
+// The original representation, for comparison.
+struct StringValue {
+    int number;
+    std::vector<std::string> fizzes;
+};
+
+template <typename V>
+class UserFacing {
+  public:
+    class promise_type;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    class InputAwaiter {
+        promise_type *promise;
+      public:
+        InputAwaiter(promise_type *promise) : promise(promise) {}
+
+        bool await_ready() { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<>) {
+            promise->yielded_value = std::nullopt;
+            return handle_type::from_promise(*promise);
+        }
+        std::optional<V> await_resume() { return promise->yielded_value; }
+    };
+
+    class OutputAwaiter {
+        promise_type *promise;
+      public:
+        OutputAwaiter(promise_type *promise) : promise(promise) {}
+
+        bool await_ready() { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<>) {
+            if (promise)
+                return handle_type::from_promise(*promise);
+            else
+                return std::noop_coroutine();
+        }
+        void await_resume() {}
+    };
+
+    class promise_type {
+        promise_type *consumer = nullptr;
+
+        // Prevent accidentally copying the promise type
+        promise_type(const promise_type &) = delete;
+        promise_type &operator=(const promise_type &) = delete;
+
+      public:
+        std::optional<V> yielded_value;
+
+        promise_type() = default;
+
+        UserFacing get_return_object() {
+            auto handle = handle_type::from_promise(*this);
+            return UserFacing{handle};
+        }
+        std::suspend_always initial_suspend() { return {}; }
+        void return_void() {}
+        void unhandled_exception() {}
+        std::suspend_always final_suspend() noexcept { return {}; }
+
+        OutputAwaiter yield_value(V value) {
+            yielded_value = value;
+            return OutputAwaiter{consumer};
+        }
+
+        InputAwaiter await_transform(UserFacing &uf) {
+            promise_type &producer = uf.handle.promise();
+            producer.consumer = this;
+            return InputAwaiter{&producer};
+        }
+    };
+
+  private:
+    handle_type handle;
+
+    UserFacing(handle_type handle) : handle(handle) {}
+
+    UserFacing(const UserFacing &) = delete;
+    UserFacing &operator=(const UserFacing &) = delete;
+
+  public:
+    std::optional<V> next_value() {
+        auto &promise = handle.promise();
+        promise.yielded_value = std::nullopt;
+        if (!handle.done())
+            handle.resume();
+        return promise.yielded_value;
+    }
+
+    UserFacing(UserFacing &&rhs) : handle(rhs.handle) {
+        rhs.handle = nullptr;
+    }
+    UserFacing &operator=(UserFacing &&rhs) {
+        if (handle)
+            handle.destroy();
+        handle = rhs.handle;
+        rhs.handle = nullptr;
+        return *this;
+    }
+    ~UserFacing() {
+        if (handle)
+            handle.destroy();
+    }
+};
+
+// ----------------------------------------------------------------------
+// Pipeline stages, for either representation.
+
+template <typename V>
+UserFacing<V> generate_numbers(int limit) {
+    for (int i = 1; i <= limit; i++) {
+        V v;
+        v.number = i;
+        co_yield v;
+    }
+}
+
+UserFacing<Value> check_multiple(UserFacing<Value> source, int divisor, std::string fizz) {
+    const LabelTable::Id label = LabelTable::intern(fizz);
+    while (std::optional<Value> vopt = co_await source) {
+        Value &v = *vopt;
+
+        if (v.number % divisor == 0)
+            v.fizzes.push_back(label);
+
+        co_yield v;
+    }
+}
+
+UserFacing<StringValue> check_multiple(UserFacing<StringValue> source, int divisor, std::string fizz) {
+    while (std::optional<StringValue> vopt = co_await source) {
+        StringValue &v = *vopt;
+
+        if (v.number % divisor == 0)
+            v.fizzes.push_back(fizz);
+
+        co_yield v;
+    }
+}
+
+// The sink is where label ids finally turn back into text.
+void print(const Value &v) {
+    if (v.fizzes.empty()) {
+        std::cout << v.number << std::endl;
+    } else {
+        for (LabelTable::Id id : v.fizzes)
+            std::cout << LabelTable::text(id);
+        std::cout << std::endl;
+    }
+}
+
+template <typename V>
+void bench(const std::string &name, int limit) {
+    std::size_t fizzes = 0;
+    const std::size_t allocations_before = heap_allocations;
+    auto start = std::chrono::steady_clock::now();
+    {
+        UserFacing<V> c = generate_numbers<V>(limit);
+        c = check_multiple(std::move(c), 3, "Fizz");
+        c = check_multiple(std::move(c), 5, "Buzz");
+        while (std::optional<V> vopt = c.next_value())
+            fizzes += vopt->fizzes.size();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << std::left << std::setw(14) << name << ": "
+              << static_cast<std::size_t>(limit / elapsed.count()) << " items/s, "
+              << heap_allocations - allocations_before << " heap allocations"
+              << " (" << fizzes << " fizzes)" << std::endl;
+}
+
+int main() {
+    UserFacing<Value> c = generate_numbers<Value>(200);
+    c = check_multiple(std::move(c), 3, "Fizz");
+    c = check_multiple(std::move(c), 5, "Buzz");
+    while (std::optional<Value> vopt = c.next_value())
+        print(*vopt);
+
+    const int limit = 10000000;
+    bench<StringValue>("vector<string>", limit);
+    bench<Value>("interned", limit);
+}
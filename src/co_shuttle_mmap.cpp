@@ -0,0 +1,418 @@
+// The co_shuttle FizzBuzz pipeline fed from a real input file instead of
+// generate_numbers(). read_numbers() memory-maps a newline-delimited file of
+// integers and parses each one with std::from_chars straight out of the
+// mapping, so no byte is copied between the page cache and the Value handed
+// to check_multiple. The benchmark compares it with an `ifstream >> int`
+// source, alone and at the head of the pipeline.
+#include <charconv>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct Value {
+    int number;
+    std::vector<std::string> fizzes;
+};
+
+class UserFacing {
+  public:
+    class promise_type;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    class InputAwaiter {
+        promise_type *promise;
+      public:
+        InputAwaiter(promise_type *);
+
+        bool await_ready() { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<>);
+        std::optional<Value> await_resume();
+    };
+
+    class OutputAwaiter {
+        promise_type *promise;
+      public:
+        OutputAwaiter(promise_type *);
+
+        bool await_ready() { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<>);
+        void await_resume() {}
+    };
+
+    class promise_type {
+        promise_type *consumer = nullptr;
+
+        // Prevent accidentally copying the promise type
+        promise_type(const promise_type &) = delete;
+        promise_type &operator=(const promise_type &) = delete;
+
+      public:
+        std::optional<Value> yielded_value;
+
+        promise_type() = default;
+
+        UserFacing get_return_object() {
+            auto handle = handle_type::from_promise(*this);
+            return UserFacing{handle};
+        }
+        std::suspend_always initial_suspend() { return {}; }
+        void return_void() {}
+        void unhandled_exception() {}
+        std::suspend_always final_suspend() noexcept { return {}; }
+
+        OutputAwaiter yield_value(Value value) {
+            yielded_value = std::move(value);
+            return OutputAwaiter{consumer};
+        }
+
+        InputAwaiter await_transform(UserFacing &uf);
+    };
+
+  private:
+    handle_type handle;
+
+    UserFacing(handle_type handle) : handle(handle) {}
+
+    UserFacing(const UserFacing &) = delete;
+    UserFacing &operator=(const UserFacing &) = delete;
+
+  public:
+    std::optional<Value> next_value() {
+        auto &promise = handle.promise();
+        promise.yielded_value = std::nullopt;
+        if (!handle.done())
+            handle.resume();
+        return std::move(promise.yielded_value);
+    }
+
+    UserFacing(UserFacing &&rhs) : handle(rhs.handle) {
+        rhs.handle = nullptr;
+    }
+    UserFacing &operator=(UserFacing &&rhs) {
+        if (handle)
+            handle.destroy();
+        handle = rhs.handle;
+        rhs.handle = nullptr;
+        return *this;
+    }
+    ~UserFacing() {
+        if (handle)
+            handle.destroy();
+    }
+};
+
+// ----------------------------------------------------------------------
+// Out-of-line method definitions, which couldn't be written until
+// all the types were complete.
+
+UserFacing::InputAwaiter::InputAwaiter(promise_type *promise)
+    : promise(promise) {}
+UserFacing::OutputAwaiter::OutputAwaiter(promise_type *promise)
+    : promise(promise) {}
+
+std::coroutine_handle<>
+UserFacing::InputAwaiter::await_suspend(std::coroutine_handle<>) {
+    promise->yielded_value = std::nullopt;
+    return handle_type::from_promise(*promise);
+}
+std::coroutine_handle<>
+UserFacing::OutputAwaiter::await_suspend(std::coroutine_handle<>) {
+    if (promise)
+        return handle_type::from_promise(*promise);
+    else
+        return std::noop_coroutine();
+}
+
+std::optional<Value> UserFacing::InputAwaiter::await_resume() {
+    return std::move(promise->yielded_value);
+}
+
+auto UserFacing::promise_type::await_transform(UserFacing &uf) -> InputAwaiter {
+    promise_type &producer = uf.handle.promise();
+    producer.consumer = this;
+    return InputAwaiter{&producer};
+}
+
+// ----------------------------------------------------------------------
+// The input file.
+
+// A read-only mapping of a whole file, hinted for one front-to-back pass.
+class MappedFile {
+    const char *data = nullptr;
+    std::size_t size = 0;
+    bool ok = false;
+
+  public:
+    explicit MappedFile(const std::string &path) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "Failed to open file " << path << std::endl;
+            return;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            std::cerr << "Failed to stat file " << path << ": "
+                      << std::error_code(errno, std::generic_category()).message() << std::endl;
+        } else if (st.st_size == 0) {
+            ok = true;
+        } else {
+            void *p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                std::cerr << "Failed to map file " << path << ": "
+                          << std::error_code(errno, std::generic_category()).message() << std::endl;
+            } else {
+                data = static_cast<const char *>(p);
+                size = st.st_size;
+                ok = true;
+                // read-ahead aggressively and drop pages behind us
+                ::madvise(p, size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+                // only honoured where the kernel supports huge pages for
+                // file mappings; harmless elsewhere
+                ::madvise(p, size, MADV_HUGEPAGE);
+#endif
+            }
+        }
+        ::close(fd); // the mapping keeps the file alive
+    }
+    ~MappedFile() {
+        if (data)
+            ::munmap(const_cast<char *>(data), size);
+    }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // false if the file could not be opened or mapped; an empty file is fine
+    explicit operator bool() const { return ok; }
+    std::string_view text() const { return {data, size}; }
+};
+
+// ----------------------------------------------------------------------
+// Pipeline stages.
+
+// Parses the integer on the line starting at p into n and returns the end of
+// that line, or nullptr at the end of the text. Each line holds one decimal
+// integer with optional spaces, tabs or '\r' around it; blank lines are
+// skipped. Anything else, or a number too big for an int, is reported with
+// its offset from begin, sets *failed and returns nullptr.
+inline const char *parse_number(const char *begin, const char *p, const char *end, int &n, bool *failed = nullptr) {
+    auto blank = [](char c) { return c == ' ' || c == '\t' || c == '\r'; };
+    auto fail = [&](const char *at, const char *what) -> const char * {
+        std::cerr << what << " at offset " << (at - begin) << std::endl;
+        if (failed)
+            *failed = true;
+        return nullptr;
+    };
+    while (p != end && (blank(*p) || *p == '\n'))
+        p++;
+    if (p == end)
+        return nullptr;
+    auto [next, ec] = std::from_chars(p, end, n);
+    if (ec == std::errc::result_out_of_range)
+        return fail(p, "Number out of range");
+    if (ec != std::errc())
+        return fail(p, "Expected a number");
+    while (next != end && blank(*next))
+        next++;
+    if (next != end && *next != '\n')
+        return fail(next, "Unexpected character after a number");
+    return next;
+}
+
+// Yields every integer in the file, in order. Malformed input ends the
+// sequence early and sets *failed.
+UserFacing read_numbers(const MappedFile &file, bool *failed = nullptr) {
+    const std::string_view text = file.text();
+    const char *p = text.data(), *end = text.data() + text.size();
+    Value v;
+    while ((p = parse_number(text.data(), p, end, v.number, failed)))
+        co_yield v;
+}
+
+// The baseline source.
+UserFacing stream_numbers(std::istream &in) {
+    Value v;
+    while (in >> v.number)
+        co_yield v;
+}
+
+UserFacing check_multiple(UserFacing source, int divisor, std::string fizz) {
+    while (std::optional<Value> vopt = co_await source) {
+        Value &v = *vopt;
+
+        if (v.number % divisor == 0)
+            v.fizzes.push_back(fizz);
+
+        co_yield std::move(v);
+    }
+}
+
+UserFacing fizzbuzz(UserFacing source) {
+    UserFacing c = check_multiple(std::move(source), 3, "Fizz");
+    c = check_multiple(std::move(c), 5, "Buzz");
+    return c;
+}
+
+void print(const Value &v) {
+    if (v.fizzes.empty()) {
+        std::cout << v.number << std::endl;
+    } else {
+        for (auto &fizz: v.fizzes)
+            std::cout << fizz;
+        std::cout << std::endl;
+    }
+}
+
+// ----------------------------------------------------------------------
+// Benchmark.
+
+// numbers 1..count, one per line
+std::string write_numbers(int count) {
+    char path[] = "/tmp/co_shuttle_mmap_XXXXXX";
+    const int fd = ::mkstemp(path);
+    if (fd < 0)
+        return {};
+    FILE *out = ::fdopen(fd, "w");
+    if (!out) {
+        ::close(fd);
+        std::remove(path);
+        return {};
+    }
+    char line[16];
+    for (int i = 1; i <= count; i++) {
+        auto end = std::to_chars(line, line + sizeof(line) - 1, i).ptr;
+        *end++ = '\n';
+        std::fwrite(line, 1, end - line, out);
+    }
+    const bool failed = std::ferror(out);
+    if (std::fclose(out) != 0 || failed) {
+        std::remove(path);
+        return {};
+    }
+    return path;
+}
+
+// Removes a temporary file on every way out of the scope that made it.
+class TempFile {
+    std::string path;
+
+  public:
+    explicit TempFile(std::string path) : path(std::move(path)) {}
+    ~TempFile() {
+        if (!path.empty())
+            std::remove(path.c_str());
+    }
+    TempFile(const TempFile &) = delete;
+    TempFile &operator=(const TempFile &) = delete;
+
+    const std::string &name() const { return path; }
+    bool empty() const { return path.empty(); }
+};
+
+// Drains the chain and reports GB/s of input; the sum guards against the
+// work being optimised away and against the sources disagreeing.
+long bench(const std::string &name, std::size_t bytes, UserFacing c) {
+    long sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (std::optional<Value> vopt = c.next_value())
+        sum += vopt->number + static_cast<long>(vopt->fizzes.size());
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << std::left << std::setw(28) << name << ": " << std::fixed << std::setprecision(3)
+              << bytes / elapsed.count() / 1e9 << " GB/s" << std::endl;
+    return sum;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 2) {
+        // co_shuttle_mmap <file>: FizzBuzz over the numbers in the file
+        MappedFile file(argv[1]);
+        if (!file)
+            return 1;
+        bool failed = false;
+        UserFacing c = fizzbuzz(read_numbers(file, &failed));
+        while (std::optional<Value> vopt = c.next_value())
+            print(*vopt);
+        return failed ? 1 : 0;
+    }
+
+    {
+        const TempFile demo(write_numbers(20));
+        if (demo.empty()) {
+            std::cerr << "Failed to write the demo input" << std::endl;
+            return 1;
+        }
+        MappedFile file(demo.name());
+        if (!file)
+            return 1;
+        UserFacing c = fizzbuzz(read_numbers(file));
+        while (std::optional<Value> vopt = c.next_value())
+            print(*vopt);
+    }
+
+    const TempFile input(write_numbers(20000000));
+    if (input.empty()) {
+        std::cerr << "Failed to write the benchmark input" << std::endl;
+        return 1;
+    }
+    const std::string &path = input.name();
+    long sums[4];
+    std::size_t bytes;
+    {
+        // the parser on its own, to show what the per-value hop costs
+        MappedFile file(path);
+        if (!file)
+            return 1;
+        const std::string_view text = file.text();
+        bytes = text.size();
+        long sum = 0;
+        int n;
+        auto start = std::chrono::steady_clock::now();
+        for (const char *p = text.data(); (p = parse_number(text.data(), p, text.data() + text.size(), n));)
+            sum += n;
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << std::left << std::setw(28) << "from_chars, no coroutine" << ": " << std::fixed
+                  << std::setprecision(3) << bytes / elapsed.count() / 1e9 << " GB/s" << std::endl;
+        sums[0] = bench("mmap + from_chars", bytes, read_numbers(file));
+        if (sum != sums[0]) {
+            std::cout << "parser and read_numbers disagree" << std::endl;
+            return 1;
+        }
+    }
+    {
+        std::ifstream in(path);
+        if (!in)
+            return 1;
+        sums[1] = bench("ifstream >> int", bytes, stream_numbers(in));
+    }
+    {
+        MappedFile file(path);
+        if (!file)
+            return 1;
+        sums[2] = bench("mmap + from_chars, fizzbuzz", bytes, fizzbuzz(read_numbers(file)));
+    }
+    {
+        std::ifstream in(path);
+        if (!in)
+            return 1;
+        sums[3] = bench("ifstream >> int, fizzbuzz", bytes, fizzbuzz(stream_numbers(in)));
+    }
+    if (sums[0] != sums[1] || sums[2] != sums[3]) {
+        std::cout << "sources disagree" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,296 @@
+// The co_shuttle FizzBuzz pipeline run data-parallel: the input range is cut
+// into shards, worker threads each build an independent generate_numbers ->
+// check_multiple chain for whichever shard they claim next, and the caller
+// merges the shards' output back into the original order through a bounded
+// reorder buffer.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Value {
+    int number;
+    std::vector<std::string> fizzes;
+};
+
+class UserFacing {
+  public:
+    class promise_type;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    class InputAwaiter {
+        promise_type *promise;
+      public:
+        InputAwaiter(promise_type *);
+
+        bool await_ready() { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<>);
+        std::optional<Value> await_resume();
+    };
+
+    class OutputAwaiter {
+        promise_type *promise;
+      public:
+        OutputAwaiter(promise_type *);
+
+        bool await_ready() { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<>);
+        void await_resume() {}
+    };
+
+    class promise_type {
+        promise_type *consumer = nullptr;
+
+        // Prevent accidentally copying the promise type
+        promise_type(const promise_type &) = delete;
+        promise_type &operator=(const promise_type &) = delete;
+
+      public:
+        std::optional<Value> yielded_value;
+
+        promise_type() = default;
+
+        UserFacing get_return_object() {
+            auto handle = handle_type::from_promise(*this);
+            return UserFacing{handle};
+        }
+        std::suspend_always initial_suspend() { return {}; }
+        void return_void() {}
+        void unhandled_exception() {}
+        std::suspend_always final_suspend() noexcept { return {}; }
+
+        OutputAwaiter yield_value(Value value) {
+            yielded_value = std::move(value);
+            return OutputAwaiter{consumer};
+        }
+
+        InputAwaiter await_transform(UserFacing &uf);
+    };
+
+  private:
+    handle_type handle;
+
+    UserFacing(handle_type handle) : handle(handle) {}
+
+    UserFacing(const UserFacing &) = delete;
+    UserFacing &operator=(const UserFacing &) = delete;
+
+  public:
+    std::optional<Value> next_value() {
+        auto &promise = handle.promise();
+        promise.yielded_value = std::nullopt;
+        if (!handle.done())
+            handle.resume();
+        return std::move(promise.yielded_value);
+    }
+
+    UserFacing(UserFacing &&rhs) : handle(rhs.handle) {
+        rhs.handle = nullptr;
+    }
+    UserFacing &operator=(UserFacing &&rhs) {
+        if (handle)
+            handle.destroy();
+        handle = rhs.handle;
+        rhs.handle = nullptr;
+        return *this;
+    }
+    ~UserFacing() {
+        if (handle)
+            handle.destroy();
+    }
+};
+
+// ----------------------------------------------------------------------
+// Out-of-line method definitions, which couldn't be written until
+// all the types were complete.
+
+UserFacing::InputAwaiter::InputAwaiter(promise_type *promise)
+    : promise(promise) {}
+UserFacing::OutputAwaiter::OutputAwaiter(promise_type *promise)
+    : promise(promise) {}
+
+std::coroutine_handle<>
+UserFacing::InputAwaiter::await_suspend(std::coroutine_handle<>) {
+    promise->yielded_value = std::nullopt;
+    return handle_type::from_promise(*promise);
+}
+std::coroutine_handle<>
+UserFacing::OutputAwaiter::await_suspend(std::coroutine_handle<>) {
+    if (promise)
+        return handle_type::from_promise(*promise);
+    else
+        return std::noop_coroutine();
+}
+
+std::optional<Value> UserFacing::InputAwaiter::await_resume() {
+    return std::move(promise->yielded_value);
+}
+
+auto UserFacing::promise_type::await_transform(UserFacing &uf) -> InputAwaiter {
+    promise_type &producer = uf.handle.promise();
+    producer.consumer = this;
+    return InputAwaiter{&producer};
+}
+
+// ----------------------------------------------------------------------
+// Pipeline stages. generate_numbers takes a range so a shard can start
+// anywhere; check_multiple doesn't care where its input came from.
+
+UserFacing generate_numbers(int first, int last) {
+    for (int i = first; i <= last; i++) {
+        Value v;
+        v.number = i;
+        co_yield v;
+    }
+}
+
+UserFacing check_multiple(UserFacing source, int divisor, std::string fizz) {
+    while (std::optional<Value> vopt = co_await source) {
+        Value &v = *vopt;
+
+        if (v.number % divisor == 0)
+            v.fizzes.push_back(fizz);
+
+        co_yield std::move(v);
+    }
+}
+
+UserFacing fizzbuzz(int first, int last) {
+    UserFacing c = generate_numbers(first, last);
+    c = check_multiple(std::move(c), 3, "Fizz");
+    c = check_multiple(std::move(c), 5, "Buzz");
+    return c;
+}
+
+// ----------------------------------------------------------------------
+// Sharded runner.
+
+struct ShardOptions {
+    std::size_t threads = 1;
+    int shard_size = 16384; // numbers per shard
+    std::size_t window = 0; // shards in flight; 0 means 4 per thread
+};
+
+// Run make_pipeline(first, last) over 1..limit in shards on `threads`
+// workers and hand every value to sink in the order a single pipeline over
+// the whole range would have produced it.
+//
+// Workers claim shards in increasing order from a shared counter, so the
+// shard the merger is waiting for is always already claimed. A worker may
+// only start a shard within `window` of the merger, which bounds the
+// reorder buffer to `window` slots and keeps a slow merger from being buried.
+template <typename MakePipeline, typename Sink>
+void run_sharded(int limit, ShardOptions options, MakePipeline make_pipeline, Sink sink) {
+    struct Slot {
+        std::vector<Value> values;
+        std::atomic<std::size_t> filled{0}; // shard index + 1 once values are in
+    };
+
+    if (options.threads < 1 || options.shard_size < 1)
+        throw std::invalid_argument("run_sharded: threads and shard_size must be at least 1");
+    const std::size_t shard_size = static_cast<std::size_t>(options.shard_size);
+    const std::size_t shards = (static_cast<std::size_t>(limit) + shard_size - 1) / shard_size;
+    const std::size_t window = options.window ? options.window : 4 * options.threads;
+    std::vector<Slot> slots(window);
+    std::atomic<std::size_t> next_shard{0};
+    std::atomic<std::size_t> merged{0};
+
+    auto work = [&] {
+        for (;;) {
+            const std::size_t shard = next_shard.fetch_add(1, std::memory_order_relaxed);
+            if (shard >= shards)
+                return;
+            for (std::size_t m = merged.load(std::memory_order_acquire); shard >= m + window;
+                 m = merged.load(std::memory_order_acquire))
+                merged.wait(m, std::memory_order_acquire);
+
+            Slot &slot = slots[shard % window];
+            slot.values.clear();
+            const int first = static_cast<int>(shard * shard_size) + 1;
+            const int last = static_cast<int>(std::min<std::size_t>((shard + 1) * shard_size, limit));
+            UserFacing c = make_pipeline(first, last);
+            while (std::optional<Value> vopt = c.next_value())
+                slot.values.push_back(std::move(*vopt));
+            slot.filled.store(shard + 1, std::memory_order_release);
+            slot.filled.notify_one();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (std::size_t t = 0; t < options.threads; t++)
+        workers.emplace_back(work);
+
+    for (std::size_t shard = 0; shard < shards; shard++) {
+        Slot &slot = slots[shard % window];
+        for (std::size_t f = slot.filled.load(std::memory_order_acquire); f != shard + 1;
+             f = slot.filled.load(std::memory_order_acquire))
+            slot.filled.wait(f, std::memory_order_acquire);
+        for (Value &v : slot.values)
+            sink(v);
+        merged.store(shard + 1, std::memory_order_release);
+        merged.notify_all();
+    }
+    for (auto &t : workers)
+        t.join();
+}
+
+void print(const Value &v) {
+    if (v.fizzes.empty()) {
+        std::cout << v.number << std::endl;
+    } else {
+        for (auto &fizz: v.fizzes)
+            std::cout << fizz;
+        std::cout << std::endl;
+    }
+}
+
+// Items/s through the sink, which also checks that the merge kept order.
+template <typename Run>
+double bench(int limit, Run run) {
+    int expected = 1;
+    bool in_order = true;
+    auto start = std::chrono::steady_clock::now();
+    run([&](const Value &v) { in_order &= v.number == expected++; });
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (!in_order || expected != limit + 1)
+        return -1;
+    return limit / elapsed.count();
+}
+
+int main() {
+    // small shards and a small window so the merge is really exercised
+    run_sharded(200, {4, 7, 3}, fizzbuzz, print);
+
+    const int limit = 20000000;
+    const std::size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    const double serial = bench(limit, [&](auto sink) {
+        UserFacing c = fizzbuzz(1, limit);
+        while (std::optional<Value> vopt = c.next_value())
+            sink(*vopt);
+    });
+    std::cout << std::left << std::setw(12) << "serial" << ": "
+              << static_cast<std::size_t>(serial) << " items/s" << std::endl;
+
+    std::vector<std::size_t> counts;
+    for (std::size_t threads = 1; threads < cores; threads *= 2)
+        counts.push_back(threads);
+    counts.push_back(cores);
+    for (std::size_t threads : counts) {
+        const double rate = bench(limit, [&](auto sink) { run_sharded(limit, {threads}, fizzbuzz, sink); });
+        if (rate < 0) {
+            std::cout << "sharded run came back out of order" << std::endl;
+            return 1;
+        }
+        std::cout << std::left << std::setw(12) << ("threads " + std::to_string(threads)) << ": "
+                  << static_cast<std::size_t>(rate) << " items/s, speedup "
+                  << std::setprecision(3) << rate / serial << std::endl;
+    }
+}
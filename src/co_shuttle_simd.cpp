@@ -0,0 +1,377 @@
+// The batched co_shuttle FizzBuzz pipeline with one vectorised stage in place
+// of a check_multiple per divisor. Each block carries a bitmask per number,
+// and check_multiples sets bit k when the number is divisible by divisor k,
+// testing several divisors at once with a multiply by the modular inverse
+// instead of a division. The kernel (AVX-512, AVX2 or scalar) is picked at
+// startup from what CPUID says the machine supports.
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+// A block of numbers and their divisibility masks, owned by the stage that
+// produced it and valid until the consumer asks that stage for the next one.
+struct Block {
+    std::span<std::uint32_t> numbers;
+    std::span<std::uint32_t> masks;
+};
+
+class UserFacing {
+  public:
+    class promise_type;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    class InputAwaiter {
+        promise_type *promise;
+      public:
+        InputAwaiter(promise_type *);
+
+        bool await_ready() { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<>);
+        std::optional<Block> await_resume();
+    };
+
+    class OutputAwaiter {
+        promise_type *promise;
+      public:
+        OutputAwaiter(promise_type *);
+
+        bool await_ready() { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<>);
+        void await_resume() {}
+    };
+
+    class promise_type {
+        promise_type *consumer = nullptr;
+
+        // Prevent accidentally copying the promise type
+        promise_type(const promise_type &) = delete;
+        promise_type &operator=(const promise_type &) = delete;
+
+      public:
+        std::optional<Block> yielded_value;
+
+        promise_type() = default;
+
+        UserFacing get_return_object() {
+            auto handle = handle_type::from_promise(*this);
+            return UserFacing{handle};
+        }
+        std::suspend_always initial_suspend() { return {}; }
+        void return_void() {}
+        void unhandled_exception() {}
+        std::suspend_always final_suspend() noexcept { return {}; }
+
+        OutputAwaiter yield_value(Block block) {
+            yielded_value = block;
+            return OutputAwaiter{consumer};
+        }
+
+        InputAwaiter await_transform(UserFacing &uf);
+    };
+
+  private:
+    handle_type handle;
+
+    UserFacing(handle_type handle) : handle(handle) {}
+
+    UserFacing(const UserFacing &) = delete;
+    UserFacing &operator=(const UserFacing &) = delete;
+
+  public:
+    std::optional<Block> next_block() {
+        auto &promise = handle.promise();
+        promise.yielded_value = std::nullopt;
+        if (!handle.done())
+            handle.resume();
+        return promise.yielded_value;
+    }
+
+    UserFacing(UserFacing &&rhs) : handle(rhs.handle) {
+        rhs.handle = nullptr;
+    }
+    UserFacing &operator=(UserFacing &&rhs) {
+        if (handle)
+            handle.destroy();
+        handle = rhs.handle;
+        rhs.handle = nullptr;
+        return *this;
+    }
+    ~UserFacing() {
+        if (handle)
+            handle.destroy();
+    }
+};
+
+// ----------------------------------------------------------------------
+// Out-of-line method definitions, which couldn't be written until
+// all the types were complete.
+
+UserFacing::InputAwaiter::InputAwaiter(promise_type *promise)
+    : promise(promise) {}
+UserFacing::OutputAwaiter::OutputAwaiter(promise_type *promise)
+    : promise(promise) {}
+
+std::coroutine_handle<>
+UserFacing::InputAwaiter::await_suspend(std::coroutine_handle<>) {
+    promise->yielded_value = std::nullopt;
+    return handle_type::from_promise(*promise);
+}
+std::coroutine_handle<>
+UserFacing::OutputAwaiter::await_suspend(std::coroutine_handle<>) {
+    if (promise)
+        return handle_type::from_promise(*promise);
+    else
+        return std::noop_coroutine();
+}
+
+std::optional<Block> UserFacing::InputAwaiter::await_resume() {
+    return promise->yielded_value;
+}
+
+auto UserFacing::promise_type::await_transform(UserFacing &uf) -> InputAwaiter {
+    promise_type &producer = uf.handle.promise();
+    producer.consumer = this;
+    return InputAwaiter{&producer};
+}
+
+// ----------------------------------------------------------------------
+// Divisibility without division: write d = d0 * 2^k with d0 odd, and let
+// inverse be d0's inverse mod 2^32. Then n is a multiple of d exactly when
+// rotr(n * inverse, k) <= (2^32 - 1) / d, all in 32-bit arithmetic.
+
+struct Divisor {
+    std::uint32_t inverse;
+    std::uint32_t shift;
+    std::uint32_t limit;
+
+    explicit Divisor(std::uint32_t d)
+        : shift(static_cast<std::uint32_t>(std::countr_zero(d))), limit(UINT32_MAX / d) {
+        const std::uint32_t odd = d >> shift;
+        inverse = odd; // correct to 3 bits; each Newton step doubles that
+        for (int i = 0; i < 4; i++)
+            inverse *= 2 - odd * inverse;
+    }
+    bool divides(std::uint32_t n) const {
+        return std::rotr(n * inverse, static_cast<int>(shift)) <= limit;
+    }
+};
+
+// ORs bit k into masks[i] for every numbers[i] that divisor k divides.
+using Kernel = void (*)(std::span<const Divisor>, const std::uint32_t *numbers,
+                        std::uint32_t *masks, std::size_t count);
+
+void kernel_scalar(std::span<const Divisor> divisors, const std::uint32_t *numbers,
+                   std::uint32_t *masks, std::size_t count) {
+    for (std::size_t k = 0; k < divisors.size(); k++) {
+        const Divisor d = divisors[k];
+        for (std::size_t i = 0; i < count; i++)
+            masks[i] |= static_cast<std::uint32_t>(d.divides(numbers[i])) << k;
+    }
+}
+
+#ifdef HAVE_X86_KERNELS
+__attribute__((target("avx2")))
+void kernel_avx2(std::span<const Divisor> divisors, const std::uint32_t *numbers,
+                 std::uint32_t *masks, std::size_t count) {
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i n = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(numbers + i));
+        __m256i mask = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(masks + i));
+        for (std::size_t k = 0; k < divisors.size(); k++) {
+            const Divisor &d = divisors[k];
+            const __m256i product = _mm256_mullo_epi32(n, _mm256_set1_epi32(static_cast<int>(d.inverse)));
+            const __m128i right = _mm_cvtsi32_si128(static_cast<int>(d.shift));
+            const __m128i left = _mm_cvtsi32_si128(static_cast<int>((32 - d.shift) & 31));
+            const __m256i rotated = d.shift ? _mm256_or_si256(_mm256_srl_epi32(product, right),
+                                                              _mm256_sll_epi32(product, left))
+                                            : product;
+            // unsigned x <= limit  <=>  min(x, limit) == x
+            const __m256i limit = _mm256_set1_epi32(static_cast<int>(d.limit));
+            const __m256i hit = _mm256_cmpeq_epi32(_mm256_min_epu32(rotated, limit), rotated);
+            mask = _mm256_or_si256(mask, _mm256_and_si256(hit, _mm256_set1_epi32(1 << k)));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(masks + i), mask);
+    }
+    kernel_scalar(divisors, numbers + i, masks + i, count - i);
+}
+
+__attribute__((target("avx512f")))
+void kernel_avx512(std::span<const Divisor> divisors, const std::uint32_t *numbers,
+                   std::uint32_t *masks, std::size_t count) {
+    std::size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m512i n = _mm512_loadu_si512(numbers + i);
+        __m512i mask = _mm512_loadu_si512(masks + i);
+        for (std::size_t k = 0; k < divisors.size(); k++) {
+            const Divisor &d = divisors[k];
+            const __m512i product = _mm512_mullo_epi32(n, _mm512_set1_epi32(static_cast<int>(d.inverse)));
+            const __m512i rotated = _mm512_maskz_rorv_epi32(0xffff, product, _mm512_set1_epi32(static_cast<int>(d.shift)));
+            const __mmask16 hit = _mm512_cmple_epu32_mask(rotated, _mm512_set1_epi32(static_cast<int>(d.limit)));
+            mask = _mm512_mask_or_epi32(mask, hit, mask, _mm512_set1_epi32(1 << k));
+        }
+        _mm512_storeu_si512(masks + i, mask);
+    }
+    kernel_scalar(divisors, numbers + i, masks + i, count - i);
+}
+#endif
+
+struct KernelChoice {
+    const char *name;
+    Kernel kernel;
+};
+
+// Every kernel this machine can run, best first.
+std::vector<KernelChoice> available_kernels() {
+    std::vector<KernelChoice> kernels;
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        kernels.push_back({"avx512", kernel_avx512});
+    if (__builtin_cpu_supports("avx2"))
+        kernels.push_back({"avx2", kernel_avx2});
+#endif
+    kernels.push_back({"scalar", kernel_scalar});
+    return kernels;
+}
+
+// ----------------------------------------------------------------------
+// Pipeline stages.
+
+UserFacing generate_numbers(std::uint32_t limit, std::size_t batch_size) {
+    batch_size = std::max<std::size_t>(batch_size, 1);
+    std::vector<std::uint32_t> numbers(batch_size), masks(batch_size);
+    // 64-bit so that limit == UINT32_MAX still ends
+    for (std::uint64_t first = 1; first <= limit;) {
+        const std::size_t n = std::min<std::size_t>(batch_size, limit - first + 1);
+        for (std::size_t i = 0; i < n; i++) {
+            numbers[i] = static_cast<std::uint32_t>(first + i);
+            masks[i] = 0;
+        }
+        first += n;
+        co_yield Block{{numbers.data(), n}, {masks.data(), n}};
+    }
+}
+
+// The scalar stage: one per divisor, testing each number with %.
+UserFacing check_multiple(UserFacing source, std::uint32_t divisor, std::uint32_t bit) {
+    while (std::optional<Block> block = co_await source) {
+        for (std::size_t i = 0; i < block->numbers.size(); i++) {
+            if (block->numbers[i] % divisor == 0)
+                block->masks[i] |= bit;
+        }
+        co_yield *block;
+    }
+}
+
+// The vectorised stage: all divisors in one pass over the block. Divisor k
+// sets bit k, so at most 32 divisors.
+constexpr std::size_t max_divisors = 32;
+
+UserFacing check_multiples(UserFacing source, std::vector<Divisor> divisors, Kernel kernel) {
+    while (std::optional<Block> block = co_await source) {
+        kernel(divisors, block->numbers.data(), block->masks.data(), block->numbers.size());
+        co_yield *block;
+    }
+}
+
+// Checks the divisors up front, since the coroutine above only runs once the
+// chain is pulled.
+UserFacing check_multiples(UserFacing source, const std::vector<std::uint32_t> &divisors, Kernel kernel) {
+    if (divisors.size() > max_divisors)
+        throw std::invalid_argument("check_multiples: at most 32 divisors");
+    if (std::find(divisors.begin(), divisors.end(), 0u) != divisors.end())
+        throw std::invalid_argument("check_multiples: divisor 0");
+    return check_multiples(std::move(source), std::vector<Divisor>(divisors.begin(), divisors.end()), kernel);
+}
+
+void print(std::uint32_t number, std::uint32_t mask, const std::vector<std::string> &labels) {
+    if (mask == 0) {
+        std::cout << number << std::endl;
+    } else {
+        for (std::size_t k = 0; k < labels.size(); k++) {
+            if (mask & (1u << k))
+                std::cout << labels[k];
+        }
+        std::cout << std::endl;
+    }
+}
+
+template <typename MakeChain>
+void bench(const std::string &name, std::uint32_t limit, MakeChain make_chain) {
+    std::size_t fizzed = 0;
+    auto start = std::chrono::steady_clock::now();
+    UserFacing c = make_chain();
+    while (std::optional<Block> block = c.next_block()) {
+        for (std::uint32_t mask : block->masks)
+            fizzed += mask != 0;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << std::left << std::setw(24) << name << ": " << static_cast<std::size_t>(limit / elapsed.count())
+              << " items/s (" << fizzed << " fizzed)" << std::endl;
+}
+
+int main() {
+    const std::vector<KernelChoice> kernels = available_kernels();
+    const std::vector<std::uint32_t> divisors = {3, 5};
+    const std::vector<std::string> labels = {"Fizz", "Buzz"};
+
+    UserFacing c = generate_numbers(200, 16);
+    c = check_multiples(std::move(c), divisors, kernels.front().kernel);
+    while (std::optional<Block> block = c.next_block()) {
+        for (std::size_t i = 0; i < block->numbers.size(); i++)
+            print(block->numbers[i], block->masks[i], labels);
+    }
+
+    // the same answers from every kernel, checked against % on awkward values
+    const std::vector<std::uint32_t> awkward = {1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 24, 32, 96, 1000, 65536, 3 << 20};
+    std::vector<std::uint32_t> numbers(4099);
+    for (std::size_t i = 0; i < numbers.size(); i++)
+        numbers[i] = static_cast<std::uint32_t>(i * 2654435761u) ^ static_cast<std::uint32_t>(i);
+    numbers[0] = 0;
+    numbers[1] = UINT32_MAX;
+    for (std::size_t first = 0; first < awkward.size(); first += 8) {
+        std::vector<std::uint32_t> set(awkward.begin() + first, awkward.begin() + first + 8);
+        std::vector<Divisor> prepared(set.begin(), set.end());
+        for (auto &choice : kernels) {
+            std::vector<std::uint32_t> masks(numbers.size(), 0);
+            choice.kernel(prepared, numbers.data(), masks.data(), numbers.size());
+            for (std::size_t i = 0; i < numbers.size(); i++) {
+                std::uint32_t expected = 0;
+                for (std::size_t k = 0; k < set.size(); k++)
+                    expected |= static_cast<std::uint32_t>(numbers[i] % set[k] == 0) << k;
+                if (masks[i] != expected) {
+                    std::cout << choice.name << " kernel wrong for " << numbers[i] << std::endl;
+                    return 1;
+                }
+            }
+        }
+    }
+
+    const std::uint32_t limit = 50000000;
+    const std::size_t batch_size = 1024;
+    bench("scalar chain (%)", limit, [&] {
+        UserFacing chain = generate_numbers(limit, batch_size);
+        for (std::size_t k = 0; k < divisors.size(); k++)
+            chain = check_multiple(std::move(chain), divisors[k], 1u << k);
+        return chain;
+    });
+    for (auto &choice : kernels) {
+        bench(std::string("check_multiples ") + choice.name, limit, [&] {
+            return check_multiples(generate_numbers(limit, batch_size), divisors, choice.kernel);
+        });
+    }
+}
@@ -0,0 +1,523 @@
+// Coroutine synchronisation primitives that suspend the coroutine rather
+// than block the thread: async_mutex (`co_await m.lock()` returns a scoped
+// guard), async_semaphore and async_manual_reset_event. Each keeps its whole
+// state in one atomic word. The uncontended acquire is a single CAS. Waiters
+// are pushed onto an intrusive stack of awaiters that live in their own
+// frames, so waiting allocates nothing and takes no lock.
+//
+// Woken coroutines go on the waking thread's ready queue. A coroutine that
+// suspends doesn't return to a scheduler loop: its await_suspend hands the
+// thread straight to the next ready coroutine by symmetric transfer, the way
+// SuspendOtherAwaiter in co_awaiters.cpp does.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Intrusive list node; awaiters and tasks embed it.
+struct Waiter {
+    Waiter *next = nullptr;
+    std::coroutine_handle<> handle;
+};
+
+// This thread's coroutines that are ready to run, in FIFO order.
+class ReadyQueue {
+    Waiter *head = nullptr;
+    Waiter **tail = &head;
+    // Transfers since run() last had control. Unless the compiler turns the
+    // transfer into a tail call (it doesn't without optimisation or under the
+    // sanitizers), each one is a stack frame deeper, so after a while we go
+    // back to run() instead.
+    unsigned chained = 0;
+    static constexpr unsigned max_chained = 256;
+
+  public:
+    static ReadyQueue &local() {
+        static thread_local ReadyQueue queue;
+        return queue;
+    }
+
+    void schedule(Waiter *w) {
+        w->next = nullptr;
+        *tail = w;
+        tail = &w->next;
+    }
+
+    // What a suspending coroutine should transfer to.
+    std::coroutine_handle<> next() {
+        Waiter *w = head;
+        if (!w || ++chained > max_chained)
+            return std::noop_coroutine();
+        head = w->next;
+        if (!head)
+            tail = &head;
+        return w->handle;
+    }
+
+    // Run until nothing on this thread is ready. Suspending coroutines chain
+    // into each other, so this loop only sees control again when the queue
+    // runs dry.
+    void run() {
+        while (head) {
+            chained = 0;
+            next().resume();
+        }
+    }
+};
+
+// Turns a stack of waiters into a FIFO and back.
+inline Waiter *reverse(Waiter *list) {
+    Waiter *reversed = nullptr;
+    while (list) {
+        Waiter *next = list->next;
+        list->next = reversed;
+        reversed = list;
+        list = next;
+    }
+    return reversed;
+}
+
+// Schedules a stack of waiters, oldest (the bottom of the stack) first.
+inline void schedule_all(Waiter *stack) {
+    Waiter *fifo = reverse(stack);
+    while (fifo) {
+        Waiter *next = fifo->next;
+        ReadyQueue::local().schedule(fifo);
+        fifo = next;
+    }
+}
+
+// ----------------------------------------------------------------------
+// async_mutex
+
+class async_mutex {
+    // not_locked, locked with no waiters (0), or locked with the newest
+    // waiter at the top of a stack
+    static constexpr std::uintptr_t not_locked = 1;
+    std::atomic<std::uintptr_t> state{not_locked};
+    // Waiters taken off the stack, oldest first. Only the holder touches it.
+    Waiter *waiters = nullptr;
+
+  public:
+    class lock_guard {
+        async_mutex *mutex;
+
+      public:
+        explicit lock_guard(async_mutex &m) : mutex(&m) {}
+        lock_guard(lock_guard &&rhs) : mutex(std::exchange(rhs.mutex, nullptr)) {}
+        lock_guard(const lock_guard &) = delete;
+        lock_guard &operator=(const lock_guard &) = delete;
+        ~lock_guard() {
+            if (mutex)
+                mutex->unlock();
+        }
+    };
+
+    class LockAwaiter : public Waiter {
+        async_mutex &mutex;
+
+      public:
+        explicit LockAwaiter(async_mutex &m) : mutex(m) {}
+
+        bool await_ready() { return mutex.try_lock(); }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) {
+            handle = h;
+            std::uintptr_t old = mutex.state.load(std::memory_order_relaxed);
+            for (;;) {
+                if (old == not_locked) {
+                    if (mutex.state.compare_exchange_weak(old, 0, std::memory_order_acquire,
+                                                          std::memory_order_relaxed))
+                        return h; // got it after all
+                } else {
+                    next = reinterpret_cast<Waiter *>(old);
+                    if (mutex.state.compare_exchange_weak(old, reinterpret_cast<std::uintptr_t>(this),
+                                                          std::memory_order_release, std::memory_order_relaxed))
+                        return ReadyQueue::local().next(); // unlock() hands the lock over to us
+                }
+            }
+        }
+        [[nodiscard]] lock_guard await_resume() { return lock_guard{mutex}; }
+    };
+
+    async_mutex() = default;
+    async_mutex(const async_mutex &) = delete;
+    async_mutex &operator=(const async_mutex &) = delete;
+
+    bool try_lock() {
+        std::uintptr_t expected = not_locked;
+        return state.compare_exchange_strong(expected, 0, std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    LockAwaiter lock() { return LockAwaiter{*this}; }
+
+    // Hands the lock straight to the oldest waiter, if there is one.
+    void unlock() {
+        if (!waiters) {
+            std::uintptr_t expected = 0;
+            if (state.compare_exchange_strong(expected, not_locked, std::memory_order_release,
+                                              std::memory_order_relaxed))
+                return;
+            // take the stack of new waiters, oldest first
+            waiters = reverse(reinterpret_cast<Waiter *>(state.exchange(0, std::memory_order_acquire)));
+        }
+        Waiter *w = waiters;
+        waiters = w->next;
+        ReadyQueue::local().schedule(w);
+    }
+};
+
+// ----------------------------------------------------------------------
+// async_semaphore
+
+class async_semaphore {
+    // Either (permits << 1) | 1, or the top of a stack of waiters when no
+    // permits are left. Waiters are aligned, so the low bit tells them apart.
+    std::atomic<std::uintptr_t> state;
+
+    static bool has_permits_field(std::uintptr_t s) { return s & 1; }
+
+    // Put waiters that release() took off the stack back on it, first
+    // handing them any permits released in the meantime. `fifo` is oldest
+    // first.
+    void return_waiters(Waiter *fifo) {
+        std::uintptr_t old = state.load(std::memory_order_relaxed);
+        for (;;) {
+            while (fifo && has_permits_field(old) && (old >> 1) > 0) {
+                if (state.compare_exchange_weak(old, old - 2, std::memory_order_acquire,
+                                                std::memory_order_relaxed)) {
+                    Waiter *w = fifo;
+                    fifo = w->next;
+                    ReadyQueue::local().schedule(w);
+                }
+            }
+            if (!fifo)
+                return;
+            // Back on the stack, above anybody who started waiting since;
+            // that only costs strict fairness.
+            Waiter *bottom = fifo;
+            Waiter *stack = reverse(fifo);
+            for (;;) {
+                bottom->next = has_permits_field(old) ? nullptr : reinterpret_cast<Waiter *>(old);
+                if (state.compare_exchange_weak(old, reinterpret_cast<std::uintptr_t>(stack),
+                                                std::memory_order_release, std::memory_order_relaxed))
+                    return;
+                if (has_permits_field(old) && (old >> 1) > 0)
+                    break;
+            }
+            bottom->next = nullptr;
+            fifo = reverse(stack);
+        }
+    }
+
+  public:
+    class AcquireAwaiter : public Waiter {
+        async_semaphore &sem;
+
+      public:
+        explicit AcquireAwaiter(async_semaphore &s) : sem(s) {}
+
+        bool await_ready() { return sem.try_acquire(); }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) {
+            handle = h;
+            std::uintptr_t old = sem.state.load(std::memory_order_relaxed);
+            for (;;) {
+                if (has_permits_field(old) && (old >> 1) > 0) {
+                    if (sem.state.compare_exchange_weak(old, old - 2, std::memory_order_acquire,
+                                                        std::memory_order_relaxed))
+                        return h;
+                    continue;
+                }
+                next = has_permits_field(old) ? nullptr : reinterpret_cast<Waiter *>(old);
+                if (sem.state.compare_exchange_weak(old, reinterpret_cast<std::uintptr_t>(this),
+                                                    std::memory_order_release, std::memory_order_relaxed))
+                    return ReadyQueue::local().next(); // release() hands a permit to us
+            }
+        }
+        void await_resume() {}
+    };
+
+    explicit async_semaphore(std::size_t permits) : state((permits << 1) | 1) {}
+    async_semaphore(const async_semaphore &) = delete;
+    async_semaphore &operator=(const async_semaphore &) = delete;
+
+    bool try_acquire() {
+        std::uintptr_t old = state.load(std::memory_order_relaxed);
+        while (has_permits_field(old) && (old >> 1) > 0) {
+            if (state.compare_exchange_weak(old, old - 2, std::memory_order_acquire, std::memory_order_relaxed))
+                return true;
+        }
+        return false;
+    }
+
+    AcquireAwaiter acquire() { return AcquireAwaiter{*this}; }
+
+    // Gives the permit to the oldest waiter if anybody is waiting.
+    void release() {
+        std::uintptr_t old = state.load(std::memory_order_relaxed);
+        for (;;) {
+            if (has_permits_field(old)) {
+                if (state.compare_exchange_weak(old, old + 2, std::memory_order_release,
+                                                std::memory_order_relaxed))
+                    return;
+                continue;
+            }
+            // take every waiter, leaving no permits and nobody waiting
+            if (state.compare_exchange_weak(old, 1, std::memory_order_acq_rel, std::memory_order_relaxed))
+                break;
+        }
+        Waiter *oldest = reverse(reinterpret_cast<Waiter *>(old));
+        Waiter *rest = oldest->next;
+        ReadyQueue::local().schedule(oldest);
+        return_waiters(rest);
+    }
+};
+
+// ----------------------------------------------------------------------
+// async_manual_reset_event
+
+class async_manual_reset_event {
+    // this when set, otherwise the top of a stack of waiters (or null)
+    std::atomic<std::uintptr_t> state{0};
+
+    std::uintptr_t set_state() const { return reinterpret_cast<std::uintptr_t>(this); }
+
+  public:
+    class WaitAwaiter : public Waiter {
+        async_manual_reset_event &event;
+
+      public:
+        explicit WaitAwaiter(async_manual_reset_event &e) : event(e) {}
+
+        bool await_ready() { return event.is_set(); }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) {
+            handle = h;
+            std::uintptr_t old = event.state.load(std::memory_order_acquire);
+            for (;;) {
+                if (old == event.set_state())
+                    return h;
+                next = reinterpret_cast<Waiter *>(old);
+                if (event.state.compare_exchange_weak(old, reinterpret_cast<std::uintptr_t>(this),
+                                                      std::memory_order_release, std::memory_order_acquire))
+                    return ReadyQueue::local().next();
+            }
+        }
+        void await_resume() {}
+    };
+
+    explicit async_manual_reset_event(bool initially_set = false) : state(initially_set ? set_state() : 0) {}
+    async_manual_reset_event(const async_manual_reset_event &) = delete;
+    async_manual_reset_event &operator=(const async_manual_reset_event &) = delete;
+
+    bool is_set() const { return state.load(std::memory_order_acquire) == set_state(); }
+
+    WaitAwaiter operator co_await() { return WaitAwaiter{*this}; }
+
+    // Wakes everybody waiting, oldest first.
+    void set() {
+        const std::uintptr_t old = state.exchange(set_state(), std::memory_order_acq_rel);
+        if (old != set_state())
+            schedule_all(reinterpret_cast<Waiter *>(old));
+    }
+
+    void reset() {
+        std::uintptr_t expected = set_state();
+        state.compare_exchange_strong(expected, 0, std::memory_order_relaxed);
+    }
+};
+
+// ----------------------------------------------------------------------
+// A coroutine nobody waits for. spawn() puts it on this thread's ready
+// queue; it frees its own frame when it finishes and hands the thread on.
+
+struct Task {
+    struct promise_type {
+        Waiter node;
+
+        Task get_return_object() {
+            node.handle = std::coroutine_handle<promise_type>::from_promise(*this);
+            return Task{this};
+        }
+        std::suspend_always initial_suspend() { return {}; }
+        auto final_suspend() noexcept {
+            struct FinalAwaiter {
+                bool await_ready() noexcept { return false; }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) noexcept {
+                    std::coroutine_handle<> next = ReadyQueue::local().next();
+                    h.destroy();
+                    return next;
+                }
+                void await_resume() noexcept {}
+            };
+            return FinalAwaiter{};
+        }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+    promise_type *promise;
+};
+
+void spawn(Task task) {
+    ReadyQueue::local().schedule(&task.promise->node);
+}
+
+// ----------------------------------------------------------------------
+// Demo
+
+Task greet(async_manual_reset_event &ready, async_mutex &console, int id) {
+    co_await ready;
+    auto guard = co_await console.lock();
+    std::cout << "worker " << id << " passed the event and holds the mutex" << std::endl;
+}
+
+// ----------------------------------------------------------------------
+// Benchmarks
+
+// Spawn per_thread tasks on each of `threads` threads and run them to
+// completion; returns seconds.
+template <typename MakeTask>
+double run_on_threads(int threads, int per_thread, MakeTask make_task) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.emplace_back([&] {
+            for (int i = 0; i < per_thread; i++)
+                spawn(make_task());
+            ReadyQueue::local().run();
+        });
+    }
+    for (auto &t : pool)
+        t.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+Task count_under_mutex(async_mutex &m, long &counter, int rounds) {
+    for (int i = 0; i < rounds; i++) {
+        auto guard = co_await m.lock();
+        counter++;
+    }
+}
+
+Task count_under_semaphore(async_semaphore &sem, std::atomic<int> &inside, std::atomic<int> &most, int rounds) {
+    for (int i = 0; i < rounds; i++) {
+        co_await sem.acquire();
+        const int now = inside.fetch_add(1, std::memory_order_relaxed) + 1;
+        int seen = most.load(std::memory_order_relaxed);
+        while (now > seen && !most.compare_exchange_weak(seen, now, std::memory_order_relaxed)) {
+        }
+        inside.fetch_sub(1, std::memory_order_relaxed);
+        sem.release();
+    }
+}
+
+Task ping(async_manual_reset_event &mine, async_manual_reset_event &theirs, int rounds) {
+    for (int i = 0; i < rounds; i++) {
+        co_await mine;
+        mine.reset();
+        theirs.set();
+    }
+}
+
+void print_rate(const std::string &name, double ops, double seconds) {
+    std::cout << std::left << std::setw(34) << name << ": " << std::right << std::setw(12)
+              << static_cast<std::size_t>(ops / seconds) << " ops/s" << std::endl;
+}
+
+int main() {
+    {
+        async_manual_reset_event ready;
+        async_mutex console;
+        for (int id = 0; id < 3; id++)
+            spawn(greet(ready, console, id));
+        ReadyQueue::local().run(); // everybody is now waiting for the event
+        std::cout << "setting the event" << std::endl;
+        ready.set();
+        ReadyQueue::local().run();
+    }
+
+    // uncontended: one CAS to lock, one to unlock
+    {
+        const int rounds = 10000000;
+        async_mutex m;
+        long counter = 0;
+        const double seconds = run_on_threads(1, 1, [&] { return count_under_mutex(m, counter, rounds); });
+        print_rate("async_mutex uncontended", rounds, seconds);
+
+        std::mutex sm;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++) {
+            std::lock_guard lock(sm);
+            counter++;
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        print_rate("std::mutex uncontended", rounds, elapsed.count());
+        if (counter != 2L * rounds) {
+            std::cout << "lost increments" << std::endl;
+            return 1;
+        }
+    }
+
+    const int per_thread = 4, rounds = 200000;
+    const int cores = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<int> thread_counts{1, 2, 4};
+    if (cores > 4)
+        thread_counts.push_back(cores);
+    for (int threads : thread_counts) {
+        const std::string suffix = " " + std::to_string(threads) + " threads";
+        const long total = static_cast<long>(threads) * per_thread * rounds;
+
+        async_mutex m;
+        long counter = 0;
+        double seconds = run_on_threads(threads, per_thread, [&] { return count_under_mutex(m, counter, rounds); });
+        print_rate("async_mutex" + suffix, total, seconds);
+
+        std::mutex sm;
+        long blocking_counter = 0;
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> pool;
+        for (int t = 0; t < threads; t++) {
+            pool.emplace_back([&] {
+                for (long i = 0; i < static_cast<long>(per_thread) * rounds; i++) {
+                    std::lock_guard lock(sm);
+                    blocking_counter++;
+                }
+            });
+        }
+        for (auto &t : pool)
+            t.join();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        print_rate("std::mutex" + suffix, total, elapsed.count());
+
+        async_semaphore sem(2);
+        std::atomic<int> inside{0}, most{0};
+        seconds = run_on_threads(threads, per_thread, [&] { return count_under_semaphore(sem, inside, most, rounds); });
+        print_rate("async_semaphore(2)" + suffix, total, seconds);
+
+        if (counter != total || blocking_counter != total || most > 2) {
+            std::cout << "lost increments or too many inside the semaphore" << std::endl;
+            return 1;
+        }
+    }
+
+    // two coroutines handing control back and forth through two events
+    {
+        const int rounds = 1000000;
+        async_manual_reset_event a(true), b;
+        auto start = std::chrono::steady_clock::now();
+        spawn(ping(a, b, rounds));
+        spawn(ping(b, a, rounds));
+        ReadyQueue::local().run();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        print_rate("async_manual_reset_event ping-pong", 2.0 * rounds, elapsed.count());
+    }
+}
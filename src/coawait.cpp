@@ -1,31 +1,287 @@
 #include <coroutine>
 #include <iostream>
-size_t level = 0;
-std::string INDENT = "-";
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Asynchronous line logger. Callers don't format anything: a record is the
+// indentation, a message that must be a string literal and at most one
+// argument, appended to a buffer owned by the calling thread. Full buffers go
+// to a background writer that formats them and writes each batch with one
+// fwrite and one fflush, instead of a flush per line. Lines from one thread
+// stay in order; lines from different threads interleave a batch at a time.
+class Log
+{
+public:
+    // write every line straight through, flushed, as std::endl did (for
+    // comparison); only switch while no other thread is logging
+    static inline bool synchronous = false;
+
+    static void write(std::size_t indent, const char *message)
+    {
+        Record r;
+        r.indent = indent;
+        r.message = message;
+        append(std::move(r));
+    }
+
+    template <typename T>
+    static void write(std::size_t indent, const char *message, const T &arg)
+    {
+        Record r;
+        r.indent = indent;
+        r.message = message;
+        if constexpr (std::is_integral_v<T>)
+        {
+            r.kind = Record::Number;
+            r.number = static_cast<long long>(arg);
+        }
+        else if constexpr (std::is_convertible_v<const T &, std::string_view>)
+        {
+            r.kind = Record::Text;
+            r.text = std::string_view(arg);
+        }
+        else
+        {
+            std::ostringstream out;
+            out << arg;
+            r.kind = Record::Text;
+            r.text = out.str();
+        }
+        append(std::move(r));
+    }
+
+    // hand over this thread's buffer and wait until everything handed over
+    // so far is written
+    static void flush()
+    {
+        auto &log = instance();
+        log.submit(local().records);
+        std::unique_lock lock(log.m_mutex);
+        const std::size_t target = log.m_submitted;
+        log.m_written_cv.wait(lock, [&] { return log.m_written >= target; });
+    }
+
+    // lines written out so far, in either mode; flush() first to include
+    // what is still buffered
+    static std::size_t lines_written()
+    {
+        std::lock_guard lock(instance().m_mutex);
+        return instance().m_lines;
+    }
+
+    // where lines go, stdout unless changed; flush() before switching
+    static void set_output(std::FILE *file)
+    {
+        std::lock_guard lock(instance().m_mutex);
+        instance().m_file = file;
+    }
+
+private:
+    struct Record
+    {
+        std::size_t indent = 0; // dashes in front of the message
+        const char *message = "";
+        enum Kind : unsigned char
+        {
+            None,
+            Number,
+            Text
+        } kind = None;
+        long long number = 0;
+        std::string text;
+    };
+
+    static constexpr std::size_t batch_size = 1024;
+
+    struct Buffer
+    {
+        std::vector<Record> records;
+        Buffer()
+        {
+            instance(); // the writer must outlive every thread's buffer
+            records.reserve(batch_size);
+        }
+        ~Buffer() { instance().submit(records); }
+    };
+
+    std::mutex m_mutex;
+    std::condition_variable m_pending_cv;
+    std::condition_variable m_written_cv;
+    std::deque<std::vector<Record>> m_pending;
+    std::size_t m_submitted = 0;
+    std::size_t m_written = 0;
+    std::size_t m_lines = 0;
+    std::FILE *m_file = stdout;
+    bool m_stop = false;
+    std::thread m_writer;
+
+    Log() : m_writer([this] { run(); }) {}
+    ~Log()
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stop = true;
+        }
+        m_pending_cv.notify_one();
+        m_writer.join();
+    }
+
+    static Log &instance()
+    {
+        static Log log;
+        return log;
+    }
+    static Buffer &local()
+    {
+        static thread_local Buffer buffer;
+        return buffer;
+    }
+
+    static void format(std::string &out, const Record &r)
+    {
+        out.append(r.indent, '-');
+        out.append(r.message);
+        if (r.kind == Record::Number)
+            out.append(std::to_string(r.number));
+        else if (r.kind == Record::Text)
+            out.append(r.text);
+        out.push_back('\n');
+    }
+
+    static void append(Record &&r)
+    {
+        if (synchronous)
+        {
+            std::string line;
+            format(line, r);
+            auto &log = instance();
+            std::lock_guard lock(log.m_mutex);
+            std::fwrite(line.data(), 1, line.size(), log.m_file);
+            std::fflush(log.m_file);
+            log.m_lines++;
+            return;
+        }
+        auto &buffer = local();
+        buffer.records.push_back(std::move(r));
+        if (buffer.records.size() == batch_size)
+            instance().submit(buffer.records);
+    }
+
+    void submit(std::vector<Record> &records)
+    {
+        if (records.empty())
+            return;
+        std::vector<Record> full;
+        full.reserve(batch_size);
+        full.swap(records);
+        {
+            std::lock_guard lock(m_mutex);
+            m_pending.push_back(std::move(full));
+            m_submitted++;
+        }
+        m_pending_cv.notify_one();
+    }
+
+    void run()
+    {
+        std::string out;
+        std::unique_lock lock(m_mutex);
+        for (;;)
+        {
+            m_pending_cv.wait(lock, [&] { return m_stop || !m_pending.empty(); });
+            if (m_pending.empty())
+                return;
+            std::deque<std::vector<Record>> batches;
+            batches.swap(m_pending);
+            std::FILE *file = m_file;
+            lock.unlock();
+            out.clear();
+            std::size_t lines = 0;
+            for (auto &batch : batches)
+            {
+                for (auto &r : batch)
+                    format(out, r);
+                lines += batch.size();
+            }
+            std::fwrite(out.data(), 1, out.size(), file);
+            std::fflush(file);
+            lock.lock();
+            m_written += batches.size();
+            m_lines += lines;
+            m_written_cv.notify_all();
+        }
+    }
+};
+
+// Depth of the Trace scopes open against one coroutine; each promise has one,
+// and each thread has one for code outside any coroutine's own machinery.
+struct Indent
+{
+    std::size_t level = 0;
+
+    static Indent &thread()
+    {
+        static thread_local Indent indent;
+        return indent;
+    }
+};
 
 class Trace
 {
 public:
-    Trace()
+    explicit Trace(Indent &indent = Indent::thread())
+        : m_indent(indent)
     {
-        in_level();
+        m_indent.level += 1;
     }
     ~Trace()
     {
-        level -= 1;
+        m_indent.level -= 1;
     }
-    void in_level()
+    void log(const char *message)
     {
-        level += 1;
-        std::string res(INDENT);
-        for (size_t i = 0; i < level; i++)
-        {
-            res.append(INDENT);
-        };
-        std::cout << res;
+        Log::write(m_indent.level + 1, message);
     }
+    template <typename T>
+    void log(const char *message, const T &arg)
+    {
+        Log::write(m_indent.level + 1, message, arg);
+    }
+
+private:
+    Indent &m_indent;
 };
 
+// `co_await this_indent()` hands a coroutine body the Indent in its own
+// promise, without suspending, so its Trace scopes nest with the promise's.
+struct this_indent
+{
+    Indent *indent = nullptr;
+    bool await_ready() { return false; }
+    template <typename Promise>
+    bool await_suspend(std::coroutine_handle<Promise> h)
+    {
+        indent = &h.promise().indent;
+        return false;
+    }
+    Indent &await_resume() { return *indent; }
+};
+
+// <thread> drags in unistd.h, whose ::sync() would clash with sync<T>
+namespace coawait
+{
+
 template <typename T>
 struct sync
 {
@@ -36,21 +292,24 @@ struct sync
     sync(handle_type h)
         : coro(h)
     {
-        Trace t;
-        std::cout << "Sync: Created a sync object" << std::endl;
+        Trace t(indent());
+        t.log("Sync: Created a sync object");
     }
     sync(const sync &) = delete;
     sync(sync &&s)
         : coro(s.coro)
     {
-        Trace t;
-        std::cout << "Sync: Sync moved leaving behind a husk" << std::endl;
+        Trace t(indent());
+        t.log("Sync: Sync moved leaving behind a husk");
         s.coro = nullptr;
     }
     ~sync()
     {
-        Trace t;
-        std::cout << "Sync: Sync gone" << std::endl;
+        {
+            // the promise, and the Indent in it, goes away with the coroutine
+            Trace t(indent());
+            t.log("Sync: Sync gone");
+        }
         if (coro)
             coro.destroy();
     }
@@ -64,47 +323,48 @@ struct sync
 
     T get()
     {
-        Trace t;
-        std::cout << "Sync: We got asked for the return value..." << std::endl;
+        Trace t(indent());
+        t.log("Sync: We got asked for the return value...");
         return coro.promise().value;
     }
     struct promise_type
     {
         T value;
+        Indent indent;
         promise_type()
         {
-            Trace t;
-            std::cout << "Sync-Promise: Promise created" << std::endl;
+            Trace t(indent);
+            t.log("Sync-Promise: Promise created");
         }
         ~promise_type()
         {
-            Trace t;
-            std::cout << "Sync-Promise: Promise died" << std::endl;
+            Trace t(indent);
+            t.log("Sync-Promise: Promise died");
         }
 
         auto get_return_object()
         {
-            Trace t;
-            std::cout << "Sync-Promise: Send back a sync" << std::endl;
+            Trace t(indent);
+            t.log("Sync-Promise: Send back a sync");
             return sync<T>{handle_type::from_promise(*this)};
         }
         auto initial_suspend()
         {
-            Trace t;
-            std::cout << "Sync-Promise: Started the coroutine, don't stop now!" << std::endl;
+            Trace t(indent);
+            t.log("Sync-Promise: Started the coroutine, don't stop now!");
             return std::suspend_never{};
         }
         auto return_value(T v)
         {
-            Trace t;
-            std::cout << "Sync-Promise: Got an answer of " << v << std::endl;
+            Trace t(indent);
+            t.log("Sync-Promise: Got an answer of ", v);
             value = v;
             return std::suspend_never{};
         }
         auto final_suspend() noexcept
         {
-            Trace t;
-            std::cout << "Sync-Promise: Finished the coro" << std::endl;
+            Trace t(indent);
+            t.log("Sync-Promise: Finished the coro");
             return std::suspend_always{};
         }
         void unhandled_exception()
@@ -113,10 +373,17 @@ struct sync
         }
     };
     void resume() {
-        Trace t;
-        std::cout << "Sync: About to resume the sync" << std::endl;
+        Trace t(indent());
+        t.log("Sync: About to resume the sync");
         coro.resume();
     }
+
+private:
+    // a moved-from husk has no coroutine of its own any more
+    Indent &indent()
+    {
+        return coro ? coro.promise().indent : Indent::thread();
+    }
 };
 
 template <typename T>
@@ -129,21 +396,24 @@ struct lazy
     lazy(handle_type h)
         : coro(h)
     {
-        Trace t;
-        std::cout << "Lazy: Created a lazy object" << std::endl;
+        Trace t(indent());
+        t.log("Lazy: Created a lazy object");
     }
     lazy(const lazy &) = delete;
     lazy(lazy &&s)
         : coro(s.coro)
     {
-        Trace t;
-        std::cout << "Lazy: lazy moved leaving behind a husk" << std::endl;
+        Trace t(indent());
+        t.log("Lazy: lazy moved leaving behind a husk");
         s.coro = nullptr;
     }
     ~lazy()
     {
-        Trace t;
-        std::cout << "Lazy: lazy gone" << std::endl;
+        {
+            // the promise, and the Indent in it, goes away with the coroutine
+            Trace t(indent());
+            t.log("Lazy: lazy gone");
+        }
         if (coro)
             coro.destroy();
     }
@@ -157,47 +427,48 @@ struct lazy
 
     T get()
     {
-        Trace t;
-        std::cout << "Lazy: We got asked for the return value..." << std::endl;
+        Trace t(indent());
+        t.log("Lazy: We got asked for the return value...");
         return coro.promise().value;
     }
     struct promise_type
     {
         T value;
+        Indent indent;
         promise_type()
         {
-            Trace t;
-            std::cout << "Lazy-Promise: Promise created" << std::endl;
+            Trace t(indent);
+            t.log("Lazy-Promise: Promise created");
         }
         ~promise_type()
         {
-            Trace t;
-            std::cout << "Lazy-Promise: Promise died" << std::endl;
+            Trace t(indent);
+            t.log("Lazy-Promise: Promise died");
         }
 
         auto get_return_object()
         {
-            Trace t;
-            std::cout << "Lazy-Promise: Send back a lazy" << std::endl;
+            Trace t(indent);
+            t.log("Lazy-Promise: Send back a lazy");
             return lazy<T>{handle_type::from_promise(*this)};
         }
         auto initial_suspend()
         {
-            Trace t;
-            std::cout << "Lazy-Promise: Started the coroutine, put the brakes on!" << std::endl;
+            Trace t(indent);
+            t.log("Lazy-Promise: Started the coroutine, put the brakes on!");
             return std::suspend_always{};
         }
         auto return_value(T v)
         {
-            Trace t;
-            std::cout << "Lazy-Promise: Got an answer of " << v << std::endl;
+            Trace t(indent);
+            t.log("Lazy-Promise: Got an answer of ", v);
             value = v;
             return std::suspend_never{};
         }
         auto final_suspend() noexcept
         {
-            Trace t;
-            std::cout << "Lazy-Promise: Finished the coro" << std::endl;
+            Trace t(indent);
+            t.log("Lazy-Promise: Finished the coro");
             return std::suspend_always{};
         }
         void unhandled_exception()
@@ -208,8 +479,8 @@ struct lazy
     bool await_ready()
     {
         const auto ready = this->coro.done();
-        Trace t;
-        std::cout << "Lazy: Await " << (ready ? "is ready" : "isn't ready") << std::endl;
+        Trace t(indent());
+        t.log(ready ? "Lazy: Await is ready" : "Lazy: Await isn't ready");
         return this->coro.done();
     }
     handle_type await_suspend(std::coroutine_handle<> awaiting)
@@ -227,30 +498,84 @@ struct lazy
     auto await_resume()
     {
         const auto r = this->coro.promise().value;
-        Trace t;
-        std::cout << "Lazy: Await value is returned: " << r << std::endl;
+        Trace t(indent());
+        t.log("Lazy: Await value is returned: ", r);
         return r;
     }
+
+private:
+    Indent &indent()
+    {
+        return coro ? coro.promise().indent : Indent::thread();
+    }
 };
 lazy<std::string> read_data()
 {
-    Trace t;
-    std::cout << "reading_data(): Reading data..." << std::endl;
+    Trace t(co_await this_indent());
+    t.log("reading_data(): Reading data...");
     co_return "reading_data: billion$!";
 }
 
 sync<int> reply()
 {
-    std::cout << "reply(): Started await_answer" << std::endl;
+    Log::write(0, "reply(): Started await_answer");
     auto a = co_await read_data();
-    std::cout << "reply(): read result is " << a << std::endl;
+    Log::write(0, "reply(): read result is ", a);
     co_return 42;
 }
 
-int main()
+} // namespace coawait
+
+// Run reply() `rounds` times on each of `threads` threads, logging into
+// `file`, and report lines/s with the logger in the given mode.
+void bench(bool synchronous, std::size_t threads, int rounds, std::FILE *file)
+{
+    Log::flush();
+    Log::set_output(file);
+    Log::synchronous = synchronous;
+    const std::size_t lines_before = Log::lines_written();
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (std::size_t i = 0; i < threads; i++)
+    {
+        workers.emplace_back([rounds] {
+            for (int r = 0; r < rounds; r++)
+            {
+                auto a = coawait::reply();
+                a.resume();
+                a.get();
+            }
+            Log::flush();
+        });
+    }
+    for (auto &w : workers)
+        w.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    Log::synchronous = false;
+    Log::set_output(stdout);
+    const double lines = static_cast<double>(Log::lines_written() - lines_before);
+    std::cout << (synchronous ? "flush per line" : "async batches ")
+              << ", " << threads << " thread(s): " << elapsed.count() * 1e3 << " ms, "
+              << static_cast<std::size_t>(lines / elapsed.count()) << " lines/s" << std::endl;
+}
+
+int main(int argc, char **argv)
 {
-    std::cout << "main: Start main()\n";
-    auto a = reply();
+    if (argc > 1 && std::string(argv[1]) == "--bench")
+    {
+        std::FILE *sink = std::tmpfile();
+        for (std::size_t threads : {1, 4})
+        {
+            bench(true, threads, 20000, sink);
+            bench(false, threads, 20000, sink);
+        }
+        std::fclose(sink);
+        return 0;
+    }
+
+    Log::write(0, "main: Start main()");
+    auto a = coawait::reply();
     a.resume();
-    return a.get();
+    const int answer = a.get();
+    return answer;
 }
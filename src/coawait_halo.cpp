@@ -0,0 +1,302 @@
+// Does the compiler elide the frame of a lazy<T> awaited from a sync<T>?
+// The sync/lazy pair from coawait.cpp minus the tracing (a call into iostream
+// in every promise hook is enough to block elision), and with the lazy
+// resuming its awaiter from final_suspend as in coawait_pool.cpp so that
+// lazies can nest. The lazy promise counts the frames it creates and the ones
+// that reach its operator new.
+// Each nested-task shape below is run once and reported as elided or not;
+// halo_matrix.sh builds this file across compilers and optimisation levels.
+#include <coroutine>
+#include <cstddef>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct FrameCounter
+{
+    static inline std::size_t frames = 0;
+    static inline std::size_t allocations = 0;
+};
+
+template <typename T>
+struct sync
+{
+    struct promise_type;
+    using handle_type = std::coroutine_handle<promise_type>;
+    handle_type coro;
+
+    sync(handle_type h)
+        : coro(h)
+    {
+    }
+    sync(const sync &) = delete;
+    sync(sync &&s)
+        : coro(s.coro)
+    {
+        s.coro = nullptr;
+    }
+    ~sync()
+    {
+        if (coro)
+            coro.destroy();
+    }
+    sync &operator=(const sync &) = delete;
+
+    T get()
+    {
+        return coro.promise().value;
+    }
+    struct promise_type
+    {
+        T value;
+
+        auto get_return_object()
+        {
+            return sync<T>{handle_type::from_promise(*this)};
+        }
+        auto initial_suspend()
+        {
+            return std::suspend_never{};
+        }
+        void return_value(T v)
+        {
+            value = v;
+        }
+        auto final_suspend() noexcept
+        {
+            return std::suspend_always{};
+        }
+        void unhandled_exception()
+        {
+            std::exit(1);
+        }
+    };
+};
+
+template <typename T>
+struct lazy
+{
+    struct promise_type;
+    using handle_type = std::coroutine_handle<promise_type>;
+    handle_type coro;
+
+    lazy(handle_type h)
+        : coro(h)
+    {
+    }
+    lazy(const lazy &) = delete;
+    lazy(lazy &&s)
+        : coro(s.coro)
+    {
+        s.coro = nullptr;
+    }
+    ~lazy()
+    {
+        if (coro)
+            coro.destroy();
+    }
+    lazy &operator=(const lazy &) = delete;
+
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept { return false; }
+        std::coroutine_handle<> await_suspend(handle_type h) noexcept
+        {
+            return h.promise().continuation;
+        }
+        void await_resume() noexcept {}
+    };
+
+    struct promise_type
+    {
+        T value;
+        std::coroutine_handle<> continuation;
+        promise_type()
+        {
+            FrameCounter::frames++;
+        }
+
+        // Only reached when the frame was not elided into the caller's.
+        static void *operator new(std::size_t size)
+        {
+            FrameCounter::allocations++;
+            return ::operator new(size);
+        }
+        static void operator delete(void *p, std::size_t size)
+        {
+            ::operator delete(p, size);
+        }
+
+        auto get_return_object()
+        {
+            return lazy<T>{handle_type::from_promise(*this)};
+        }
+        auto initial_suspend()
+        {
+            return std::suspend_always{};
+        }
+        void return_value(T v)
+        {
+            value = v;
+        }
+        auto final_suspend() noexcept
+        {
+            return FinalAwaiter{};
+        }
+        void unhandled_exception()
+        {
+            std::exit(1);
+        }
+    };
+    bool await_ready()
+    {
+        return this->coro.done();
+    }
+    handle_type await_suspend(std::coroutine_handle<> awaiting)
+    {
+        this->coro.promise().continuation = awaiting;
+        return this->coro;
+    }
+    auto await_resume()
+    {
+        return this->coro.promise().value;
+    }
+};
+
+// ----------------------------------------------------------------------
+// Children.
+
+lazy<int> read_data(int x)
+{
+    co_return x * 2 + 1;
+}
+
+[[gnu::noinline]] lazy<int> read_data_opaque(int x)
+{
+    co_return x * 2 + 1;
+}
+
+lazy<int> read_twice(int x)
+{
+    int a = co_await read_data(x);
+    int b = co_await read_data(a);
+    co_return b;
+}
+
+// plain function handing back a child it made
+lazy<int> forward_read(int x)
+{
+    return read_data(x);
+}
+
+// ----------------------------------------------------------------------
+// Parents, one per nested-task shape.
+
+// the shape of reply() in coawait.cpp
+sync<int> await_temporary(int x)
+{
+    co_return co_await read_data(x);
+}
+
+sync<int> await_named(int x)
+{
+    auto child = read_data(x);
+    co_return co_await child;
+}
+
+sync<int> await_in_loop(int x)
+{
+    int sum = 0;
+    for (int i = 0; i < 4; i++)
+        sum += co_await read_data(x + i);
+    co_return sum;
+}
+
+sync<int> await_two_levels(int x)
+{
+    co_return co_await read_twice(x);
+}
+
+sync<int> await_forwarded(int x)
+{
+    co_return co_await forward_read(x);
+}
+
+sync<int> await_noinline(int x)
+{
+    co_return co_await read_data_opaque(x);
+}
+
+// the child outlives the expression that made it, in a container
+sync<int> await_from_vector(int x)
+{
+    std::vector<lazy<int>> children;
+    children.push_back(read_data(x));
+    auto &child = children.front();
+    co_return co_await child;
+}
+
+// ----------------------------------------------------------------------
+
+struct Pattern
+{
+    const char *name;
+    sync<int> (*parent)(int);
+};
+
+std::string toolchain()
+{
+    std::ostringstream out;
+#if defined(__clang__)
+    out << "clang " << __clang_major__ << "." << __clang_minor__ << "." << __clang_patchlevel__;
+#elif defined(__GNUC__)
+    out << "gcc " << __GNUC__ << "." << __GNUC_MINOR__ << "." << __GNUC_PATCHLEVEL__;
+#else
+    out << "unknown";
+#endif
+#ifdef HALO_OPT_LEVEL
+    out << " " << HALO_OPT_LEVEL;
+#elif !defined(__OPTIMIZE__)
+    out << " -O0";
+#endif
+    return out.str();
+}
+
+int main()
+{
+    // called through the table so main itself can't fold a whole pattern away
+    static const Pattern patterns[] = {
+        {"temporary", await_temporary},
+        {"named local", await_named},
+        {"loop of 4", await_in_loop},
+        {"two levels", await_two_levels},
+        {"forwarded", await_forwarded},
+        {"noinline child", await_noinline},
+        {"from vector", await_from_vector},
+    };
+
+    std::cout << "toolchain: " << toolchain() << std::endl;
+    std::cout << std::left << std::setw(16) << "pattern"
+              << std::right << std::setw(8) << "frames" << std::setw(8) << "allocs"
+              << "  elided" << std::endl;
+    int checksum = 0;
+    for (auto &pattern : patterns)
+    {
+        FrameCounter::frames = 0;
+        FrameCounter::allocations = 0;
+        {
+            auto s = pattern.parent(checksum & 1);
+            checksum += s.get();
+        }
+        const std::size_t frames = FrameCounter::frames;
+        const std::size_t allocations = FrameCounter::allocations;
+        std::cout << std::left << std::setw(16) << pattern.name
+                  << std::right << std::setw(8) << frames << std::setw(8) << allocations << "  "
+                  << (allocations == 0 ? "yes" : allocations < frames ? "partly" : "no") << std::endl;
+    }
+    std::cout << "(checksum " << checksum << ")" << std::endl;
+}
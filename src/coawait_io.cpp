@@ -0,0 +1,621 @@
+// Asynchronous file I/O for lazy<T>: co_await async_read(io, fd, buf, off)
+// submits to io_uring and the event loop resumes the awaiting coroutine when
+// the completion arrives. Where io_uring is unavailable, a thread pool does
+// the pread/pwrite and signals the loop through an eventfd watched by epoll.
+#include <coroutine>
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+template <typename T>
+struct lazy
+{
+    struct promise_type;
+    using handle_type = std::coroutine_handle<promise_type>;
+    handle_type coro;
+
+    lazy(handle_type h) : coro(h) {}
+    lazy(const lazy &) = delete;
+    lazy(lazy &&s) : coro(s.coro)
+    {
+        s.coro = nullptr;
+    }
+    ~lazy()
+    {
+        if (coro)
+            coro.destroy();
+    }
+    lazy &operator=(const lazy &) = delete;
+
+    // resumes whoever co_awaited us once the body has finished
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept { return false; }
+        std::coroutine_handle<> await_suspend(handle_type h) noexcept
+        {
+            if (h.promise().continuation)
+                return h.promise().continuation;
+            return std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    struct promise_type
+    {
+        T value;
+        std::coroutine_handle<> continuation;
+        auto get_return_object()
+        {
+            return lazy<T>{handle_type::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() { return {}; }
+        void return_value(T v)
+        {
+            value = std::move(v);
+        }
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void unhandled_exception()
+        {
+            std::exit(1);
+        }
+    };
+
+    bool await_ready()
+    {
+        return coro.done();
+    }
+    handle_type await_suspend(std::coroutine_handle<> awaiting)
+    {
+        coro.promise().continuation = awaiting;
+        return coro;
+    }
+    T await_resume()
+    {
+        return std::move(coro.promise().value);
+    }
+};
+
+// Fire-and-forget coroutine used to start the root of a task tree.
+struct detached
+{
+    struct promise_type
+    {
+        detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception()
+        {
+            std::exit(1);
+        }
+    };
+};
+
+// One outstanding read or write. It lives inside the awaiter, i.e. in the
+// frame of the suspended coroutine, so submitting never allocates.
+struct IoOp
+{
+    enum class Kind
+    {
+        Read,
+        Write,
+    };
+    Kind kind;
+    int fd;
+    void *buffer;
+    std::size_t length;
+    off_t offset;
+    ssize_t result = 0;
+    std::coroutine_handle<> waiter;
+};
+
+class IoBackend
+{
+public:
+    virtual ~IoBackend() = default;
+    virtual const char *name() const = 0;
+    virtual void submit(IoOp *op) = 0;
+    // wait for at least one completion and resume its coroutine
+    virtual void run_once() = 0;
+};
+
+class UringBackend : public IoBackend
+{
+    int m_ring_fd = -1;
+    unsigned m_entries = 0;
+    void *m_sq_ptr = MAP_FAILED;
+    void *m_cq_ptr = MAP_FAILED;
+    std::size_t m_sq_size = 0;
+    std::size_t m_cq_size = 0;
+    io_uring_sqe *m_sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+    unsigned *m_sq_head, *m_sq_tail, *m_sq_mask, *m_sq_array;
+    unsigned *m_cq_head, *m_cq_tail, *m_cq_mask;
+    io_uring_cqe *m_cqes;
+    unsigned m_unsubmitted = 0;
+    unsigned m_in_flight = 0;
+    bool m_usable = false;
+
+    static unsigned load_acquire(const unsigned *p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+    static void store_release(unsigned *p, unsigned v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_enter, m_ring_fd, to_submit, min_complete, flags, nullptr, 0));
+    }
+
+    void flush()
+    {
+        while (m_unsubmitted > 0)
+        {
+            const int n = enter(m_unsubmitted, 0, 0);
+            if (n < 0)
+            {
+                if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                    continue;
+                std::cerr << "io_uring_enter: " << std::strerror(errno) << std::endl;
+                std::exit(1);
+            }
+            m_unsubmitted -= n;
+        }
+    }
+
+    // IORING_OP_READ and IORING_OP_WRITE only arrived in 5.6; older kernels
+    // set the ring up fine and then fail every such request with -EINVAL.
+    // Those kernels don't know IORING_REGISTER_PROBE either, so a failed
+    // probe means no.
+    bool supports_read_write() const
+    {
+        constexpr unsigned ops = 256;
+        std::unique_ptr<void, void (*)(void *)> storage(std::calloc(1, sizeof(io_uring_probe) + ops * sizeof(io_uring_probe_op)), std::free);
+        auto *probe = static_cast<io_uring_probe *>(storage.get());
+        if (!probe || syscall(__NR_io_uring_register, m_ring_fd, IORING_REGISTER_PROBE, probe, ops) < 0)
+            return false;
+        auto supported = [probe](unsigned op)
+        {
+            return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+        };
+        return supported(IORING_OP_READ) && supported(IORING_OP_WRITE);
+    }
+
+    template <typename T>
+    static T *at(void *base, unsigned offset)
+    {
+        return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+    }
+
+public:
+    explicit UringBackend(unsigned entries)
+    {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        m_ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (m_ring_fd < 0)
+            return;
+        m_entries = params.sq_entries;
+        m_sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap)
+            m_sq_size = m_cq_size = std::max(m_sq_size, m_cq_size);
+        m_sq_ptr = mmap(nullptr, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+        m_cq_ptr = single_mmap ? m_sq_ptr
+                               : mmap(nullptr, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_CQ_RING);
+        m_sqes = static_cast<io_uring_sqe *>(mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+                                                  MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES));
+        if (m_sq_ptr == MAP_FAILED || m_cq_ptr == MAP_FAILED || m_sqes == MAP_FAILED)
+        {
+            close(m_ring_fd);
+            m_ring_fd = -1;
+            return;
+        }
+        m_sq_head = at<unsigned>(m_sq_ptr, params.sq_off.head);
+        m_sq_tail = at<unsigned>(m_sq_ptr, params.sq_off.tail);
+        m_sq_mask = at<unsigned>(m_sq_ptr, params.sq_off.ring_mask);
+        m_sq_array = at<unsigned>(m_sq_ptr, params.sq_off.array);
+        m_cq_head = at<unsigned>(m_cq_ptr, params.cq_off.head);
+        m_cq_tail = at<unsigned>(m_cq_ptr, params.cq_off.tail);
+        m_cq_mask = at<unsigned>(m_cq_ptr, params.cq_off.ring_mask);
+        m_cqes = at<io_uring_cqe>(m_cq_ptr, params.cq_off.cqes);
+        m_usable = supports_read_write();
+    }
+    ~UringBackend()
+    {
+        if (m_sqes != MAP_FAILED)
+            munmap(m_sqes, m_entries * sizeof(io_uring_sqe));
+        if (m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr)
+            munmap(m_cq_ptr, m_cq_size);
+        if (m_sq_ptr != MAP_FAILED)
+            munmap(m_sq_ptr, m_sq_size);
+        if (m_ring_fd >= 0)
+            close(m_ring_fd);
+    }
+    UringBackend(const UringBackend &) = delete;
+    UringBackend &operator=(const UringBackend &) = delete;
+
+    bool ok() const { return m_usable; }
+    const char *name() const override { return "io_uring"; }
+
+    void submit(IoOp *op) override
+    {
+        // the kernel only consumes submissions in io_uring_enter
+        while (*m_sq_tail - load_acquire(m_sq_head) >= m_entries)
+            flush();
+        const unsigned tail = *m_sq_tail;
+        const unsigned index = tail & *m_sq_mask;
+        io_uring_sqe &sqe = m_sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = op->kind == IoOp::Kind::Read ? IORING_OP_READ : IORING_OP_WRITE;
+        sqe.fd = op->fd;
+        sqe.addr = reinterpret_cast<std::uint64_t>(op->buffer);
+        sqe.len = static_cast<std::uint32_t>(op->length);
+        sqe.off = static_cast<std::uint64_t>(op->offset);
+        sqe.user_data = reinterpret_cast<std::uint64_t>(op);
+        m_sq_array[index] = index;
+        store_release(m_sq_tail, tail + 1);
+        m_unsubmitted++;
+        m_in_flight++;
+    }
+
+    void run_once() override
+    {
+        unsigned head = *m_cq_head;
+        if (head == load_acquire(m_cq_tail))
+        {
+            // submit everything queued since the last call and wait for one
+            const int n = enter(m_unsubmitted, m_in_flight ? 1 : 0, IORING_ENTER_GETEVENTS);
+            if (n < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            {
+                std::cerr << "io_uring_enter: " << std::strerror(errno) << std::endl;
+                std::exit(1);
+            }
+            if (n > 0)
+                m_unsubmitted -= n;
+        }
+        // resuming may submit more work, so pop each completion before resuming
+        while (head != load_acquire(m_cq_tail))
+        {
+            const io_uring_cqe &cqe = m_cqes[head & *m_cq_mask];
+            auto *op = reinterpret_cast<IoOp *>(cqe.user_data);
+            op->result = cqe.res;
+            store_release(m_cq_head, ++head);
+            m_in_flight--;
+            op->waiter.resume();
+            head = *m_cq_head;
+        }
+    }
+};
+
+class ThreadPoolBackend : public IoBackend
+{
+    int m_event_fd = -1;
+    int m_epoll_fd = -1;
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::deque<IoOp *> m_pending;
+    std::vector<IoOp *> m_completed;
+    bool m_stop = false;
+    std::vector<std::thread> m_threads;
+
+    void work()
+    {
+        std::unique_lock lock(m_mutex);
+        while (true)
+        {
+            m_wakeup.wait(lock, [this]
+                          { return m_stop || !m_pending.empty(); });
+            if (m_pending.empty())
+                return;
+            IoOp *op = m_pending.front();
+            m_pending.pop_front();
+            lock.unlock();
+            op->result = op->kind == IoOp::Kind::Read ? pread(op->fd, op->buffer, op->length, op->offset)
+                                                      : pwrite(op->fd, op->buffer, op->length, op->offset);
+            if (op->result < 0)
+                op->result = -errno;
+            lock.lock();
+            m_completed.push_back(op);
+            const std::uint64_t one = 1;
+            if (write(m_event_fd, &one, sizeof(one)) != sizeof(one))
+                std::exit(1);
+        }
+    }
+
+public:
+    explicit ThreadPoolBackend(unsigned threads)
+    {
+        m_event_fd = eventfd(0, EFD_CLOEXEC);
+        m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = m_event_fd;
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_event_fd, &ev);
+        for (unsigned i = 0; i < threads; i++)
+            m_threads.emplace_back([this]
+                                   { work(); });
+    }
+    ~ThreadPoolBackend()
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stop = true;
+        }
+        m_wakeup.notify_all();
+        for (auto &t : m_threads)
+            t.join();
+        close(m_epoll_fd);
+        close(m_event_fd);
+    }
+
+    const char *name() const override { return "thread pool + eventfd"; }
+
+    void submit(IoOp *op) override
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            m_pending.push_back(op);
+        }
+        m_wakeup.notify_one();
+    }
+
+    void run_once() override
+    {
+        epoll_event ev;
+        if (epoll_wait(m_epoll_fd, &ev, 1, -1) <= 0)
+            return;
+        std::uint64_t count = 0;
+        if (read(m_event_fd, &count, sizeof(count)) != sizeof(count))
+            return;
+        std::vector<IoOp *> completed;
+        {
+            std::lock_guard lock(m_mutex);
+            completed.swap(m_completed);
+        }
+        for (IoOp *op : completed)
+            op->waiter.resume();
+    }
+};
+
+// Picks io_uring when the kernel allows it, the thread pool otherwise.
+class IoContext
+{
+    std::unique_ptr<IoBackend> m_backend;
+
+public:
+    explicit IoContext(unsigned queue_depth = 256, bool force_fallback = false)
+    {
+        if (!force_fallback)
+        {
+            auto uring = std::make_unique<UringBackend>(queue_depth);
+            if (uring->ok())
+                m_backend = std::move(uring);
+        }
+        if (!m_backend)
+            m_backend = std::make_unique<ThreadPoolBackend>(std::max(4u, std::thread::hardware_concurrency()));
+    }
+
+    const char *backend() const { return m_backend->name(); }
+    void submit(IoOp *op) { m_backend->submit(op); }
+
+    // drive completions on the calling thread until `done` returns true
+    template <typename Predicate>
+    void run_until(Predicate done)
+    {
+        while (!done())
+            m_backend->run_once();
+    }
+};
+
+struct IoAwaiter
+{
+    IoContext &io;
+    IoOp op;
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<> h)
+    {
+        op.waiter = h;
+        io.submit(&op);
+    }
+    // bytes transferred, or -errno
+    ssize_t await_resume() { return op.result; }
+};
+
+IoAwaiter async_read(IoContext &io, int fd, void *buffer, std::size_t length, off_t offset)
+{
+    return IoAwaiter{io, IoOp{IoOp::Kind::Read, fd, buffer, length, offset, 0, {}}};
+}
+
+IoAwaiter async_write(IoContext &io, int fd, const void *buffer, std::size_t length, off_t offset)
+{
+    return IoAwaiter{io, IoOp{IoOp::Kind::Write, fd, const_cast<void *>(buffer), length, offset, 0, {}}};
+}
+
+// ----------------------------------------------------------------------
+// Benchmark: `depth` reader coroutines each keep one block in flight, so the
+// number of outstanding reads equals the queue depth.
+
+constexpr std::size_t block_size = 128 * 1024;
+
+// Reads a whole block, resubmitting the rest after a short read, and stops
+// early only at the end of the file. Bytes read, or -errno.
+lazy<ssize_t> read_block(IoContext &io, int fd, char *buffer, off_t offset)
+{
+    std::size_t done = 0;
+    while (done < block_size)
+    {
+        ssize_t n = co_await async_read(io, fd, buffer + done, block_size - done, offset + static_cast<off_t>(done));
+        if (n < 0)
+            co_return n;
+        if (n == 0)
+            break;
+        done += static_cast<std::size_t>(n);
+    }
+    co_return static_cast<ssize_t>(done);
+}
+
+// Writes a whole block, resubmitting the rest after a short write. 0, or -errno.
+lazy<ssize_t> write_block(IoContext &io, int fd, const char *buffer, off_t offset)
+{
+    std::size_t done = 0;
+    while (done < block_size)
+    {
+        ssize_t n = co_await async_write(io, fd, buffer + done, block_size - done, offset + static_cast<off_t>(done));
+        if (n < 0)
+            co_return n;
+        if (n == 0)
+            co_return -EIO;
+        done += static_cast<std::size_t>(n);
+    }
+    co_return 0;
+}
+
+detached reader(IoContext &io, int fd, std::size_t first, std::size_t stride, std::size_t blocks,
+                std::size_t &bytes, int &running)
+{
+    std::unique_ptr<char[]> buffer(new char[block_size]);
+    for (std::size_t b = first; b < blocks; b += stride)
+    {
+        ssize_t n = co_await read_block(io, fd, buffer.get(), static_cast<off_t>(b * block_size));
+        if (n < 0)
+        {
+            std::cerr << "read failed: " << std::strerror(static_cast<int>(-n)) << std::endl;
+            std::exit(1);
+        }
+        bytes += static_cast<std::size_t>(n);
+    }
+    running--;
+}
+
+detached writer(IoContext &io, int fd, std::size_t first, std::size_t stride, std::size_t blocks, int &running)
+{
+    std::unique_ptr<char[]> buffer(new char[block_size]);
+    for (std::size_t b = first; b < blocks; b += stride)
+    {
+        std::memset(buffer.get(), static_cast<int>('0' + b % 64), block_size);
+        ssize_t n = co_await write_block(io, fd, buffer.get(), static_cast<off_t>(b * block_size));
+        if (n < 0)
+        {
+            std::cerr << "write failed: " << std::strerror(static_cast<int>(-n)) << std::endl;
+            std::exit(1);
+        }
+    }
+    running--;
+}
+
+double read_file(IoContext &io, int fd, std::size_t blocks, int depth, std::size_t &bytes)
+{
+    // drop the file from the page cache so the reads reach the device
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    bytes = 0;
+    int running = depth;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < depth; i++)
+        reader(io, fd, static_cast<std::size_t>(i), static_cast<std::size_t>(depth), blocks, bytes, running);
+    io.run_until([&]
+                 { return running == 0; });
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+int main(int argc, char **argv)
+{
+    std::string path;
+    std::size_t size_mb = 64;
+    bool scratch = true;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg.rfind("--file=", 0) == 0)
+        {
+            path = arg.substr(7);
+            scratch = false;
+        }
+        else if (arg.rfind("--size-mb=", 0) == 0)
+            size_mb = std::stoul(arg.substr(10));
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--file=path] [--size-mb=N]" << std::endl;
+            return 1;
+        }
+    }
+
+    // a file given with --file is only ever read; otherwise fill a fresh
+    // scratch file of --size-mb (default 64) under $TMPDIR first
+    int fd = -1;
+    if (scratch)
+    {
+        const char *tmpdir = std::getenv("TMPDIR");
+        std::string name = std::string(tmpdir && *tmpdir ? tmpdir : "/tmp") + "/coawait_io_XXXXXX";
+        fd = mkostemp(name.data(), O_CLOEXEC);
+        path = name;
+        // unlinked straight away, so it goes with the descriptor however we exit
+        if (fd >= 0)
+            unlink(path.c_str());
+    }
+    else
+    {
+        fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (fd < 0)
+    {
+        std::cerr << "open " << path << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    std::size_t blocks = size_mb * 1024 * 1024 / block_size;
+    if (scratch)
+    {
+        IoContext io;
+        const int writers = 16;
+        int running = writers;
+        for (int i = 0; i < writers; i++)
+            writer(io, fd, static_cast<std::size_t>(i), writers, blocks, running);
+        io.run_until([&]
+                     { return running == 0; });
+        fsync(fd);
+    }
+    else
+    {
+        struct stat st;
+        if (fstat(fd, &st) < 0)
+        {
+            std::cerr << "stat " << path << ": " << std::strerror(errno) << std::endl;
+            return 1;
+        }
+        const std::size_t size = static_cast<std::size_t>(st.st_size);
+        blocks = (size + block_size - 1) / block_size;
+        size_mb = size / (1024 * 1024);
+    }
+
+    for (bool fallback : {false, true})
+    {
+        IoContext io(256, fallback);
+        std::cout << "backend: " << io.backend() << ", file " << size_mb << " MiB, block " << block_size / 1024 << " KiB" << std::endl;
+        for (int depth : {1, 4, 16, 64, 256})
+        {
+            std::size_t bytes = 0;
+            const double seconds = read_file(io, fd, blocks, depth, bytes);
+            std::cout << "  queue depth " << depth << ": " << bytes / seconds / 1e9 << " GB/s" << std::endl;
+        }
+    }
+
+    close(fd);
+}
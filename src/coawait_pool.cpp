@@ -0,0 +1,671 @@
+// Work-stealing thread pool that lazy<T> coroutines can hop onto with
+// `co_await pool.schedule()`. Each worker owns a Chase-Lev deque of coroutine
+// handles; threads that are not workers push into a global injection queue.
+// when_all()/when_any() start several lazy<T> at once and resume the parent
+// when they have all finished, or when the first one has.
+#include <coroutine>
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <latch>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// Completion hook for combinators that await several lazies at once. A lazy
+// started with a JoinState reports to it from final_suspend instead of
+// resuming a continuation.
+struct JoinState
+{
+    virtual std::coroutine_handle<> arrive(std::size_t index) noexcept = 0;
+
+protected:
+    ~JoinState() = default;
+};
+
+template <typename T>
+struct lazy
+{
+    struct promise_type;
+    using handle_type = std::coroutine_handle<promise_type>;
+    handle_type coro;
+
+    lazy(handle_type h) : coro(h) {}
+    lazy(const lazy &) = delete;
+    lazy(lazy &&s) : coro(s.coro)
+    {
+        s.coro = nullptr;
+    }
+    ~lazy()
+    {
+        if (coro)
+            coro.destroy();
+    }
+    lazy &operator=(const lazy &) = delete;
+    lazy &operator=(lazy &&s)
+    {
+        if (coro)
+            coro.destroy();
+        coro = s.coro;
+        s.coro = nullptr;
+        return *this;
+    }
+
+    // resumes whoever co_awaited us once the body has finished
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept { return false; }
+        std::coroutine_handle<> await_suspend(handle_type h) noexcept
+        {
+            if (h.promise().join)
+                return h.promise().join->arrive(h.promise().join_index);
+            if (h.promise().continuation)
+                return h.promise().continuation;
+            return std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    struct promise_type
+    {
+        T value;
+        std::coroutine_handle<> continuation;
+        JoinState *join = nullptr;
+        std::size_t join_index = 0;
+        auto get_return_object()
+        {
+            return lazy<T>{handle_type::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() { return {}; }
+        void return_value(T v)
+        {
+            value = std::move(v);
+        }
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void unhandled_exception()
+        {
+            std::exit(1);
+        }
+    };
+
+    bool await_ready()
+    {
+        return coro.done();
+    }
+    handle_type await_suspend(std::coroutine_handle<> awaiting)
+    {
+        coro.promise().continuation = awaiting;
+        return coro;
+    }
+    T await_resume()
+    {
+        return std::move(coro.promise().value);
+    }
+
+    // run until the first suspension, reporting completion to `join`
+    void start(JoinState &join, std::size_t index)
+    {
+        coro.promise().join = &join;
+        coro.promise().join_index = index;
+        coro.resume();
+    }
+};
+
+// Fire-and-forget coroutine used to start the root of a task tree.
+struct detached
+{
+    struct promise_type
+    {
+        detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception()
+        {
+            std::exit(1);
+        }
+    };
+};
+
+// Join counter for when_all: one count per child plus one held by the parent
+// while it is still starting children, so an early finisher can't resume it.
+class AllState final : public JoinState
+{
+    std::atomic<std::size_t> m_pending;
+    std::coroutine_handle<> m_parent;
+
+public:
+    explicit AllState(std::size_t children) : m_pending(children + 1) {}
+
+    void set_parent(std::coroutine_handle<> parent) { m_parent = parent; }
+    std::coroutine_handle<> arrive(std::size_t) noexcept override
+    {
+        if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            return m_parent;
+        return std::noop_coroutine();
+    }
+    // drop the parent's count; false means everybody already finished
+    bool parent_must_suspend()
+    {
+        return m_pending.fetch_sub(1, std::memory_order_acq_rel) != 1;
+    }
+};
+
+template <typename T>
+struct WhenAllVector
+{
+    std::vector<lazy<T>> tasks;
+    AllState state;
+
+    bool await_ready() { return tasks.empty(); }
+    bool await_suspend(std::coroutine_handle<> parent)
+    {
+        state.set_parent(parent);
+        for (std::size_t i = 0; i < tasks.size(); i++)
+            tasks[i].start(state, i);
+        return state.parent_must_suspend();
+    }
+    std::vector<T> await_resume()
+    {
+        std::vector<T> results;
+        results.reserve(tasks.size());
+        for (auto &t : tasks)
+            results.push_back(std::move(t.coro.promise().value));
+        return results;
+    }
+};
+
+template <typename... Ts>
+struct WhenAllTuple
+{
+    std::tuple<lazy<Ts>...> tasks;
+    AllState state{sizeof...(Ts)};
+
+    bool await_ready() { return false; }
+    bool await_suspend(std::coroutine_handle<> parent)
+    {
+        state.set_parent(parent);
+        start_all(std::index_sequence_for<Ts...>{});
+        return state.parent_must_suspend();
+    }
+    std::tuple<Ts...> await_resume()
+    {
+        return std::apply([](auto &...t)
+                          { return std::tuple<Ts...>(std::move(t.coro.promise().value)...); },
+                          tasks);
+    }
+
+private:
+    template <std::size_t... I>
+    void start_all(std::index_sequence<I...>)
+    {
+        (std::get<I>(tasks).start(state, I), ...);
+    }
+};
+
+// co_await when_all(std::move(tasks)) -> std::vector<T>
+template <typename T>
+WhenAllVector<T> when_all(std::vector<lazy<T>> tasks)
+{
+    const std::size_t n = tasks.size();
+    return WhenAllVector<T>{std::move(tasks), AllState{n}};
+}
+
+// co_await when_all(a(), b(), ...) -> std::tuple<A, B, ...>
+template <typename... Ts>
+WhenAllTuple<Ts...> when_all(lazy<Ts>... tasks)
+{
+    return WhenAllTuple<Ts...>{std::tuple<lazy<Ts>...>(std::move(tasks)...)};
+}
+
+// when_any resumes the parent while the losers may still be running, so the
+// children and the join state live in one heap block that is freed by
+// whichever of the parent and the children lets go of it last.
+template <typename T>
+class AnyState final : public JoinState
+{
+    std::vector<lazy<T>> m_tasks;
+    std::atomic<std::size_t> m_refs;
+    std::atomic<bool> m_won{false};
+    std::atomic<int> m_gate{2}; // winner and parent, whoever is second resumes
+    std::size_t m_winner = 0;
+    std::coroutine_handle<> m_parent;
+
+public:
+    explicit AnyState(std::vector<lazy<T>> tasks)
+        : m_tasks(std::move(tasks)), m_refs(m_tasks.size() + 1) {}
+
+    void release()
+    {
+        if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete this;
+    }
+
+    bool start(std::coroutine_handle<> parent)
+    {
+        m_parent = parent;
+        for (std::size_t i = 0; i < m_tasks.size(); i++)
+            m_tasks[i].start(*this, i);
+        return m_gate.fetch_sub(1, std::memory_order_acq_rel) != 1;
+    }
+
+    std::coroutine_handle<> arrive(std::size_t index) noexcept override
+    {
+        std::coroutine_handle<> next = std::noop_coroutine();
+        if (!m_won.exchange(true, std::memory_order_acq_rel))
+        {
+            m_winner = index;
+            if (m_gate.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                next = m_parent;
+        }
+        release(); // may destroy this child's frame along with the state
+        return next;
+    }
+
+    std::pair<std::size_t, T> result()
+    {
+        return {m_winner, std::move(m_tasks[m_winner].coro.promise().value)};
+    }
+};
+
+template <typename T>
+class WhenAny
+{
+    AnyState<T> *m_state;
+
+public:
+    explicit WhenAny(std::vector<lazy<T>> tasks) : m_state(new AnyState<T>(std::move(tasks))) {}
+    WhenAny(const WhenAny &) = delete;
+    WhenAny &operator=(const WhenAny &) = delete;
+    ~WhenAny()
+    {
+        m_state->release();
+    }
+
+    bool await_ready() { return false; }
+    bool await_suspend(std::coroutine_handle<> parent) { return m_state->start(parent); }
+    // index of the first task to finish, and its result
+    std::pair<std::size_t, T> await_resume() { return m_state->result(); }
+};
+
+// co_await when_any(std::move(tasks)) -> {index, value} of the first to finish
+template <typename T>
+WhenAny<T> when_any(std::vector<lazy<T>> tasks)
+{
+    return WhenAny<T>(std::move(tasks));
+}
+
+template <typename T, typename... Ts>
+WhenAny<T> when_any(lazy<T> first, lazy<Ts>... rest)
+{
+    std::vector<lazy<T>> tasks;
+    tasks.reserve(1 + sizeof...(Ts));
+    tasks.push_back(std::move(first));
+    (tasks.push_back(std::move(rest)), ...);
+    return WhenAny<T>(std::move(tasks));
+}
+
+// Bounded Chase-Lev deque (Le, Pop, Cohen, Zappa Nardelli, PPoPP'13). The owner
+// pushes and pops at the bottom, thieves take from the top. When full, push()
+// fails and the caller spills to the global queue instead of growing the ring.
+class ChaseLevDeque
+{
+public:
+    explicit ChaseLevDeque(std::size_t capacity = 1024)
+        : m_mask(capacity - 1), m_buffer(new std::atomic<void *>[capacity]) {}
+
+    bool push(std::coroutine_handle<> h)
+    {
+        const auto b = m_bottom.load(std::memory_order_relaxed);
+        const auto t = m_top.load(std::memory_order_acquire);
+        if (b - t > static_cast<std::int64_t>(m_mask))
+            return false;
+        m_buffer[b & m_mask].store(h.address(), std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    std::coroutine_handle<> pop()
+    {
+        const auto b = m_bottom.load(std::memory_order_relaxed) - 1;
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto t = m_top.load(std::memory_order_relaxed);
+        if (t > b)
+        {
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        void *item = m_buffer[b & m_mask].load(std::memory_order_relaxed);
+        if (t == b)
+        {
+            // last element, race the thieves for it
+            if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                item = nullptr;
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return std::coroutine_handle<>::from_address(item);
+    }
+
+    std::coroutine_handle<> steal()
+    {
+        auto t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const auto b = m_bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return nullptr;
+        void *item = m_buffer[t & m_mask].load(std::memory_order_relaxed);
+        if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return nullptr;
+        return std::coroutine_handle<>::from_address(item);
+    }
+
+private:
+    alignas(64) std::atomic<std::int64_t> m_top{0};
+    alignas(64) std::atomic<std::int64_t> m_bottom{0};
+    std::size_t m_mask;
+    std::unique_ptr<std::atomic<void *>[]> m_buffer;
+};
+
+class WorkStealingPool
+{
+public:
+    explicit WorkStealingPool(std::size_t threads = std::thread::hardware_concurrency())
+    {
+        if (threads == 0)
+            threads = 1;
+        for (std::size_t i = 0; i < threads; i++)
+            m_workers.push_back(std::make_unique<Worker>());
+        for (std::size_t i = 0; i < threads; i++)
+            m_workers[i]->thread = std::thread([this, i] { run(i); });
+    }
+    ~WorkStealingPool()
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stop = true;
+        }
+        m_wakeup.notify_all();
+        for (auto &w : m_workers)
+            w->thread.join();
+    }
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    std::size_t size() const { return m_workers.size(); }
+
+    // Queue a suspended coroutine. Workers of this pool use their own deque,
+    // everybody else goes through the injection queue.
+    void submit(std::coroutine_handle<> h)
+    {
+        if (t_pool == this && m_workers[t_index]->deque.push(h))
+        {
+            if (m_sleeping.load(std::memory_order_relaxed) > 0)
+                m_wakeup.notify_one();
+            return;
+        }
+        {
+            std::lock_guard lock(m_mutex);
+            m_injected.push_back(h);
+        }
+        m_wakeup.notify_one();
+    }
+
+    struct ScheduleAwaiter
+    {
+        WorkStealingPool *pool;
+        bool await_ready() { return false; }
+        void await_suspend(std::coroutine_handle<> h) { pool->submit(h); }
+        void await_resume() {}
+    };
+    // co_await pool.schedule() continues the current coroutine on a worker
+    ScheduleAwaiter schedule() { return ScheduleAwaiter{this}; }
+
+private:
+    struct Worker
+    {
+        ChaseLevDeque deque;
+        std::thread thread;
+    };
+    // the pool and worker slot the calling thread belongs to, if any
+    static inline thread_local WorkStealingPool *t_pool = nullptr;
+    static inline thread_local std::size_t t_index = 0;
+
+    std::coroutine_handle<> take_injected()
+    {
+        std::lock_guard lock(m_mutex);
+        if (m_injected.empty())
+            return nullptr;
+        auto h = m_injected.front();
+        m_injected.pop_front();
+        return h;
+    }
+
+    std::coroutine_handle<> find_work(std::size_t index, std::minstd_rand &rng)
+    {
+        if (auto h = m_workers[index]->deque.pop())
+            return h;
+        if (auto h = take_injected())
+            return h;
+        const std::size_t n = m_workers.size();
+        const std::size_t start = rng() % n;
+        for (std::size_t i = 0; i < n; i++)
+        {
+            const std::size_t victim = (start + i) % n;
+            if (victim == index)
+                continue;
+            if (auto h = m_workers[victim]->deque.steal())
+                return h;
+        }
+        return nullptr;
+    }
+
+    void run(std::size_t index)
+    {
+        t_pool = this;
+        t_index = index;
+        std::minstd_rand rng(static_cast<unsigned>(index + 1));
+        while (true)
+        {
+            if (auto h = find_work(index, rng))
+            {
+                h.resume();
+                continue;
+            }
+            std::unique_lock lock(m_mutex);
+            if (m_stop)
+                return;
+            if (!m_injected.empty())
+                continue;
+            // stolen work has no notification path from other deques, so
+            // sleep with a timeout and go round the stealing loop again
+            m_sleeping.fetch_add(1, std::memory_order_relaxed);
+            m_wakeup.wait_for(lock, std::chrono::microseconds(200));
+            m_sleeping.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::deque<std::coroutine_handle<>> m_injected;
+    std::atomic<int> m_sleeping{0};
+    bool m_stop = false;
+};
+
+// Stand-in for a read that costs real CPU time instead of printing.
+lazy<std::uint64_t> read_data(std::uint64_t seed, int work)
+{
+    std::uint64_t h = seed;
+    for (int i = 0; i < work; i++)
+    {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+    }
+    co_return h;
+}
+
+lazy<std::uint64_t> reply(WorkStealingPool &pool, std::uint64_t seed, int work)
+{
+    co_await pool.schedule();
+    auto a = co_await read_data(seed, work);
+    co_return a;
+}
+
+detached run_task(WorkStealingPool &pool, std::uint64_t seed, int work,
+                  std::atomic<std::uint64_t> &sum, std::latch &done)
+{
+    auto r = co_await reply(pool, seed, work);
+    sum.fetch_add(r, std::memory_order_relaxed);
+    done.count_down();
+}
+
+// Hop onto a worker first so the children land in its deque and idle workers
+// have to steal them.
+detached spawn_all(WorkStealingPool &pool, int tasks, int work,
+                   std::atomic<std::uint64_t> &sum, std::latch &done)
+{
+    co_await pool.schedule();
+    for (int i = 0; i < tasks; i++)
+        run_task(pool, static_cast<std::uint64_t>(i), work, sum, done);
+}
+
+// Three independent reads in flight at once instead of one after the other.
+lazy<std::uint64_t> reply_all(WorkStealingPool &pool, std::uint64_t seed, int work)
+{
+    auto [a, b, c] = co_await when_all(reply(pool, seed, work),
+                                       reply(pool, seed + 1, work),
+                                       reply(pool, seed + 2, work));
+    co_return a ^ b ^ c;
+}
+
+// Whichever replica answers first; the others still run to completion.
+lazy<std::uint64_t> reply_any(WorkStealingPool &pool, std::uint64_t seed)
+{
+    auto [index, value] = co_await when_any(reply(pool, seed, 400000),
+                                            reply(pool, seed, 1000),
+                                            reply(pool, seed, 400000));
+    std::cout << "replica " << index << " answered first" << std::endl;
+    co_return value;
+}
+
+detached run_reply(lazy<std::uint64_t> task, std::uint64_t &out, std::latch &done)
+{
+    out = co_await std::move(task);
+    done.count_down();
+}
+
+lazy<std::uint64_t> hop(WorkStealingPool &pool, std::uint64_t seed)
+{
+    co_await pool.schedule();
+    co_return seed;
+}
+
+// Fan out `children` tasks that only hop onto the pool, `rounds` times, and
+// wait for them either together with when_all or one at a time.
+detached join_rounds(WorkStealingPool &pool, std::size_t children, int rounds, bool together,
+                     std::uint64_t &sum, std::latch &done)
+{
+    for (int r = 0; r < rounds; r++)
+    {
+        std::vector<lazy<std::uint64_t>> tasks;
+        tasks.reserve(children);
+        for (std::size_t i = 0; i < children; i++)
+            tasks.push_back(hop(pool, i));
+        if (together)
+        {
+            for (auto v : co_await when_all(std::move(tasks)))
+                sum += v;
+        }
+        else
+        {
+            for (auto &t : tasks)
+                sum += co_await std::move(t);
+        }
+    }
+    done.count_down();
+}
+
+// Mean microseconds per fan-out.
+double join_latency(WorkStealingPool &pool, std::size_t children, bool together)
+{
+    const int rounds = static_cast<int>(std::max<std::size_t>(20, 200000 / children));
+    std::uint64_t sum = 0;
+    std::latch done(1);
+    auto start = std::chrono::steady_clock::now();
+    join_rounds(pool, children, rounds, together, sum, done);
+    done.wait();
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    if (sum != rounds * (children * (children - 1) / 2))
+        std::cout << "bad join sum " << sum << std::endl;
+    return elapsed.count() / rounds;
+}
+
+double fan_out(std::size_t threads, int tasks, int work, std::uint64_t &checksum)
+{
+    WorkStealingPool pool(threads);
+    std::atomic<std::uint64_t> sum{0};
+    std::latch done(tasks);
+    auto start = std::chrono::steady_clock::now();
+    spawn_all(pool, tasks, work, sum, done);
+    done.wait();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    checksum = sum.load();
+    return elapsed.count();
+}
+
+int main()
+{
+    const int tasks = 4096;
+    const int work = 20000;
+    const std::size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    {
+        WorkStealingPool pool(cores);
+        std::uint64_t all = 0, any = 0;
+        std::latch done(2);
+        run_reply(reply_all(pool, 1, work), all, done);
+        run_reply(reply_any(pool, 1), any, done);
+        done.wait();
+        std::cout << "when_all reply " << all << ", when_any reply " << any << std::endl;
+
+        std::cout << "join latency over " << cores << " workers" << std::endl;
+        for (std::size_t children : {2, 16, 1024})
+        {
+            const double sequential = join_latency(pool, children, false);
+            const double together = join_latency(pool, children, true);
+            std::cout << "children " << children
+                      << ": sequential " << sequential << " us"
+                      << ", when_all " << together << " us" << std::endl;
+        }
+    }
+
+    std::cout << "fan out " << tasks << " read_data() tasks over 1.." << cores << " workers" << std::endl;
+    std::vector<std::size_t> counts;
+    for (std::size_t threads = 1; threads < cores; threads *= 2)
+        counts.push_back(threads);
+    counts.push_back(cores);
+    double base = 0;
+    for (auto threads : counts)
+    {
+        std::uint64_t checksum = 0;
+        const double seconds = fan_out(threads, tasks, work, checksum);
+        if (threads == 1)
+            base = seconds;
+        std::cout << "workers " << threads
+                  << ": " << seconds * 1e3 << " ms"
+                  << ", tasks/s " << static_cast<std::size_t>(tasks / seconds)
+                  << ", speedup " << base / seconds
+                  << " (checksum " << checksum << ")" << std::endl;
+    }
+}
@@ -0,0 +1,422 @@
+// Hashed hierarchical timer wheel driving co_await sleep_for()/sleep_until()
+// for lazy<T> coroutines. Timer nodes are intrusive and live in the awaiter,
+// so arming and cancelling a timer is O(1) and never allocates.
+#include <coroutine>
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+template <typename T>
+struct lazy
+{
+    struct promise_type;
+    using handle_type = std::coroutine_handle<promise_type>;
+    handle_type coro;
+
+    lazy(handle_type h) : coro(h) {}
+    lazy(const lazy &) = delete;
+    lazy(lazy &&s) : coro(s.coro)
+    {
+        s.coro = nullptr;
+    }
+    ~lazy()
+    {
+        if (coro)
+            coro.destroy();
+    }
+    lazy &operator=(const lazy &) = delete;
+
+    // resumes whoever co_awaited us once the body has finished
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept { return false; }
+        std::coroutine_handle<> await_suspend(handle_type h) noexcept
+        {
+            if (h.promise().continuation)
+                return h.promise().continuation;
+            return std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    struct promise_type
+    {
+        T value;
+        std::coroutine_handle<> continuation;
+        auto get_return_object()
+        {
+            return lazy<T>{handle_type::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() { return {}; }
+        void return_value(T v)
+        {
+            value = std::move(v);
+        }
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void unhandled_exception()
+        {
+            std::exit(1);
+        }
+    };
+
+    bool await_ready()
+    {
+        return coro.done();
+    }
+    handle_type await_suspend(std::coroutine_handle<> awaiting)
+    {
+        coro.promise().continuation = awaiting;
+        return coro;
+    }
+    T await_resume()
+    {
+        return std::move(coro.promise().value);
+    }
+};
+
+// Fire-and-forget coroutine used to start the root of a task tree.
+struct detached
+{
+    struct promise_type
+    {
+        detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception()
+        {
+            std::exit(1);
+        }
+    };
+};
+
+struct TimerNode
+{
+    TimerNode *prev = nullptr;
+    TimerNode *next = nullptr;
+    std::uint64_t expires = 0;      // absolute tick
+    std::coroutine_handle<> waiter; // resumed on expiry or cancellation
+    bool fired = false;             // false if the timer was cancelled
+
+    bool linked() const { return next != nullptr; }
+    void unlink()
+    {
+        prev->next = next;
+        next->prev = prev;
+        prev = next = nullptr;
+    }
+};
+
+// Circular doubly linked list with a sentinel; must not move once used.
+class TimerList
+{
+    TimerNode m_head;
+
+public:
+    TimerList() { m_head.prev = m_head.next = &m_head; }
+    TimerList(const TimerList &) = delete;
+    TimerList &operator=(const TimerList &) = delete;
+
+    bool empty() const { return m_head.next == &m_head; }
+    void push_back(TimerNode &n)
+    {
+        n.prev = m_head.prev;
+        n.next = &m_head;
+        m_head.prev->next = &n;
+        m_head.prev = &n;
+    }
+    // move every node into `out`, leaving this list empty
+    void splice_into(TimerList &out)
+    {
+        while (!empty())
+        {
+            TimerNode &n = *m_head.next;
+            n.unlink();
+            out.push_back(n);
+        }
+    }
+    TimerNode *pop_front()
+    {
+        if (empty())
+            return nullptr;
+        TimerNode *n = m_head.next;
+        n->unlink();
+        return n;
+    }
+};
+
+// Five-level wheel in the style of the classic Linux timer: 256 one-tick slots,
+// then four levels of 64 slots each covering 64x the range of the one below.
+// Timers are filed by how far away they are; when the first level wraps, the
+// matching slot of the next level is cascaded down and re-filed.
+class TimerWheel
+{
+    static constexpr unsigned root_bits = 8;
+    static constexpr unsigned level_bits = 6;
+    static constexpr unsigned levels = 4;
+    static constexpr std::uint64_t root_size = 1u << root_bits;
+    static constexpr std::uint64_t level_size = 1u << level_bits;
+    static constexpr std::uint64_t max_delta = (std::uint64_t(1) << (root_bits + levels * level_bits)) - 1;
+
+    TimerList m_root[root_size];
+    TimerList m_levels[levels][level_size];
+    std::uint64_t m_current = 0;
+    std::size_t m_size = 0;
+
+    TimerList &slot_for(std::uint64_t expires)
+    {
+        std::uint64_t e = std::max(expires, m_current);
+        std::uint64_t delta = e - m_current;
+        if (delta < root_size)
+            return m_root[e & (root_size - 1)];
+        if (delta > max_delta)
+        {
+            // beyond the wheel's range: park at the far end, re-filed on expiry
+            e = m_current + max_delta;
+            delta = max_delta;
+        }
+        unsigned level = 0;
+        while (delta >= std::uint64_t(1) << (root_bits + (level + 1) * level_bits))
+            level++;
+        const unsigned shift = root_bits + level * level_bits;
+        return m_levels[level][(e >> shift) & (level_size - 1)];
+    }
+
+    void cascade(TimerList &slot)
+    {
+        while (TimerNode *n = slot.pop_front())
+            slot_for(n->expires).push_back(*n);
+    }
+
+public:
+    std::uint64_t current() const { return m_current; }
+    std::size_t size() const { return m_size; }
+
+    void add(TimerNode &n)
+    {
+        n.fired = false;
+        slot_for(n.expires).push_back(n);
+        m_size++;
+    }
+
+    bool cancel(TimerNode &n)
+    {
+        if (!n.linked())
+            return false;
+        n.unlink();
+        m_size--;
+        return true;
+    }
+
+    // Process every tick before `tick`, calling on_expire for each timer due.
+    // on_expire may add new timers; anything due "now" lands on the next tick.
+    template <typename F>
+    std::size_t advance_to(std::uint64_t tick, F &&on_expire)
+    {
+        std::size_t expired = 0;
+        while (m_current < tick)
+        {
+            const std::uint64_t index = m_current & (root_size - 1);
+            if (index == 0)
+            {
+                for (unsigned level = 0; level < levels; level++)
+                {
+                    const unsigned shift = root_bits + level * level_bits;
+                    const std::uint64_t slot = (m_current >> shift) & (level_size - 1);
+                    cascade(m_levels[level][slot]);
+                    if (slot != 0)
+                        break;
+                }
+            }
+            TimerList due;
+            m_root[index].splice_into(due);
+            m_current++;
+            while (TimerNode *n = due.pop_front())
+            {
+                if (n->expires >= m_current)
+                {
+                    // was parked beyond max_delta, not actually due yet
+                    slot_for(n->expires).push_back(*n);
+                    continue;
+                }
+                m_size--;
+                expired++;
+                n->fired = true;
+                on_expire(*n);
+            }
+        }
+        return expired;
+    }
+};
+
+// Single-threaded loop that turns wall-clock time into wheel ticks.
+class EventLoop
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit EventLoop(clock::duration tick = 1ms) : m_start(clock::now()), m_tick(tick) {}
+
+    // first tick at or after t
+    std::uint64_t tick_of(clock::time_point t) const
+    {
+        if (t <= m_start)
+            return 0;
+        return static_cast<std::uint64_t>((t - m_start + m_tick - clock::duration(1)) / m_tick);
+    }
+
+    void add(TimerNode &n) { m_wheel.add(n); }
+
+    // Disarm a timer; a coroutine sleeping on it is resumed with false.
+    void cancel(TimerNode &n)
+    {
+        if (m_wheel.cancel(n) && n.waiter)
+            n.waiter.resume();
+    }
+
+    std::size_t pending() const { return m_wheel.size(); }
+
+    void run()
+    {
+        while (m_wheel.size() > 0)
+        {
+            const std::uint64_t now = static_cast<std::uint64_t>((clock::now() - m_start) / m_tick);
+            m_wheel.advance_to(now + 1, [](TimerNode &n)
+                               {
+                if (n.waiter)
+                    n.waiter.resume(); });
+            if (m_wheel.size() > 0)
+                std::this_thread::sleep_until(m_start + m_wheel.current() * m_tick);
+        }
+    }
+
+private:
+    TimerWheel m_wheel;
+    clock::time_point m_start;
+    clock::duration m_tick;
+};
+
+struct SleepAwaiter
+{
+    EventLoop &loop;
+    TimerNode node;
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<> h)
+    {
+        node.waiter = h;
+        loop.add(node);
+    }
+    // true when the deadline passed, false when cancelled
+    bool await_resume() { return node.fired; }
+};
+
+SleepAwaiter sleep_until(EventLoop &loop, EventLoop::clock::time_point deadline)
+{
+    TimerNode node;
+    node.expires = loop.tick_of(deadline);
+    return SleepAwaiter{loop, node};
+}
+
+SleepAwaiter sleep_for(EventLoop &loop, EventLoop::clock::duration d)
+{
+    return sleep_until(loop, EventLoop::clock::now() + d);
+}
+
+// ----------------------------------------------------------------------
+
+lazy<int> delayed_answer(EventLoop &loop)
+{
+    co_await sleep_for(loop, 5ms);
+    co_return 42;
+}
+
+detached print_answer(EventLoop &loop)
+{
+    auto start = EventLoop::clock::now();
+    int answer = co_await delayed_answer(loop);
+    std::chrono::duration<double, std::milli> waited = EventLoop::clock::now() - start;
+    std::cout << "answer " << answer << " after " << waited.count() << " ms" << std::endl;
+}
+
+detached sleeper(EventLoop &loop, EventLoop::clock::time_point deadline, std::int32_t &lateness_us)
+{
+    co_await sleep_until(loop, deadline);
+    lateness_us = static_cast<std::int32_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(EventLoop::clock::now() - deadline).count());
+}
+
+// Raw wheel operations, without the clock or coroutines.
+void bench_wheel(std::size_t timers)
+{
+    using ns = std::chrono::duration<double, std::nano>;
+    std::mt19937_64 rng(1);
+    std::vector<TimerNode> nodes(timers);
+    TimerWheel wheel;
+
+    std::uniform_int_distribution<std::uint64_t> far(1, 10'000'000);
+    for (auto &n : nodes)
+        n.expires = far(rng);
+    auto start = EventLoop::clock::now();
+    for (auto &n : nodes)
+        wheel.add(n);
+    ns insert = EventLoop::clock::now() - start;
+
+    start = EventLoop::clock::now();
+    for (auto &n : nodes)
+        wheel.cancel(n);
+    ns cancel = EventLoop::clock::now() - start;
+
+    std::uniform_int_distribution<std::uint64_t> near(1, 100'000);
+    for (auto &n : nodes)
+    {
+        n.expires = near(rng);
+        wheel.add(n);
+    }
+    start = EventLoop::clock::now();
+    const std::size_t fired = wheel.advance_to(100'001, [](TimerNode &) {});
+    ns expire = EventLoop::clock::now() - start;
+
+    std::cout << timers << " timers: insert " << insert.count() / timers << " ns"
+              << ", cancel " << cancel.count() / timers << " ns"
+              << ", expire " << expire.count() / fired << " ns per timer"
+              << " (" << fired << " fired over 100000 ticks)" << std::endl;
+}
+
+// Many coroutines asleep at once on the real clock; reports firing lateness.
+void bench_sleepers(std::size_t count, EventLoop::clock::duration spread)
+{
+    EventLoop loop;
+    std::vector<std::int32_t> lateness(count);
+    std::mt19937_64 rng(2);
+    std::uniform_int_distribution<std::int64_t> offset(0, std::chrono::duration_cast<std::chrono::microseconds>(spread).count());
+    // deadlines start once all frames exist, so spawning doesn't count as lateness
+    const auto spawn_start = EventLoop::clock::now();
+    const auto base = spawn_start + 2s;
+    for (std::size_t i = 0; i < count; i++)
+        sleeper(loop, base + std::chrono::microseconds(offset(rng)), lateness[i]);
+    std::chrono::duration<double, std::milli> spawned = EventLoop::clock::now() - spawn_start;
+    std::cout << count << " sleeping coroutines, " << loop.pending() << " timers armed in "
+              << spawned.count() << " ms" << std::endl;
+    loop.run();
+    std::sort(lateness.begin(), lateness.end());
+    std::cout << "firing lateness: median " << lateness[count / 2] << " us"
+              << ", p99 " << lateness[count * 99 / 100] << " us"
+              << ", max " << lateness.back() << " us (1 ms ticks)" << std::endl;
+}
+
+int main()
+{
+    EventLoop loop;
+    print_answer(loop);
+    loop.run();
+
+    bench_wheel(1'000'000);
+    bench_sleepers(1'000'000, 1s);
+}
@@ -1,5 +1,16 @@
 #include <iostream>
 #include <coroutine>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+// Sync<T> hands out references to the yielded object instead of copying it
+// into the promise: the promise only keeps a pointer, which is valid while the
+// coroutine is suspended at the co_yield. T need not be default-constructible
+// or copyable.
 template <typename T>
 class Sync
 {
@@ -9,7 +20,7 @@ public:
     handle_type handle;
     struct promise_type
     {
-        T value;
+        T *value = nullptr;
         Sync get_return_object()
         {
             return Sync{handle_type::from_promise(*this)};
@@ -24,11 +35,34 @@ public:
         }
         void return_void() {}
         void unhandled_exception() {}
-        std::suspend_always yield_value(T v)
+        // an lvalue stays alive in the coroutine body across the suspension
+        std::suspend_always yield_value(T &v)
+        {
+            value = std::addressof(v);
+            return {};
+        }
+        // so does a temporary, until the end of the co_yield full-expression
+        std::suspend_always yield_value(T &&v)
         {
-            value = v;
+            value = std::addressof(v);
             return {};
         }
+        // a const lvalue can't be handed out mutably, so the awaiter keeps a
+        // copy in the coroutine frame and points the promise at it
+        auto yield_value(const T &v) requires std::is_copy_constructible_v<T>
+        {
+            struct CopyAwaiter
+            {
+                T copy;
+                bool await_ready() { return false; }
+                void await_suspend(handle_type h)
+                {
+                    h.promise().value = std::addressof(copy);
+                }
+                void await_resume() {}
+            };
+            return CopyAwaiter{v};
+        }
     };
     Sync(handle_type h) : handle(h) {}
     Sync(Sync &&s) : handle(s.handle)
@@ -50,9 +84,9 @@ public:
         }
         handle.resume();
     }
-    T value()
+    T &value()
     {
-        return handle.promise().value;
+        return *handle.promise().value;
     }
     // range access method
     struct Iter
@@ -64,7 +98,7 @@ public:
         }
         void operator++() { sync.next(); }
 
-        T operator*() const
+        T &operator*() const
         {
             return sync.value();
         }
@@ -85,6 +119,82 @@ Sync<int> getNumber(int i)
 {
     co_yield 42;
 }
+
+// 4 KiB payload that counts how often it gets copied
+struct Payload
+{
+    static inline std::size_t copies = 0;
+    std::array<std::byte, 4096> data{};
+    explicit Payload(int i) { data[0] = std::byte(i); }
+    Payload(const Payload &p) : data(p.data) { copies++; }
+    Payload &operator=(const Payload &p)
+    {
+        data = p.data;
+        copies++;
+        return *this;
+    }
+};
+
+Sync<Payload> yield_lvalues(int n)
+{
+    Payload p(0);
+    for (int i = 0; i < n; i++)
+    {
+        p.data[0] = std::byte(i);
+        co_yield p;
+    }
+}
+
+Sync<Payload> yield_rvalues(int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        co_yield Payload(i);
+    }
+}
+
+Sync<Payload> yield_const_lvalues(int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        const Payload p(i);
+        co_yield p;
+    }
+}
+
+Sync<std::unique_ptr<int>> yield_move_only(int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        co_yield std::make_unique<int>(i);
+    }
+}
+
+template <typename Gen>
+std::size_t count_copies(Gen gen)
+{
+    const std::size_t before = Payload::copies;
+    for (auto &p : gen)
+    {
+        static_cast<void>(p);
+    }
+    return Payload::copies - before;
+}
+
+template <typename Gen>
+void bench(const char *name, Gen gen, int n)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::size_t sum = 0;
+    for (auto &p : gen)
+    {
+        sum += std::to_integer<std::size_t>(p.data[p.data.size() - 1]) + std::to_integer<std::size_t>(p.data[0]);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << name << ": " << static_cast<std::size_t>(n / elapsed.count()) << " payloads/s"
+              << " (checksum " << sum << ")" << std::endl;
+}
+
 int main()
 {
     for (auto i : getNumber(5))
@@ -92,4 +202,31 @@ int main()
         std::cout << i << std::endl;
     }
     std::cout << "Hello, World!" << std::endl;
+
+    // lvalues and temporaries are handed out by reference, const lvalues are
+    // the only ones that need a copy
+    const std::size_t lvalue_copies = count_copies(yield_lvalues(100));
+    const std::size_t rvalue_copies = count_copies(yield_rvalues(100));
+    const std::size_t const_copies = count_copies(yield_const_lvalues(100));
+    std::cout << "copies for 100 lvalues: " << lvalue_copies
+              << ", rvalues: " << rvalue_copies
+              << ", const lvalues: " << const_copies << std::endl;
+    if (lvalue_copies != 0 || rvalue_copies != 0 || const_copies != 100)
+    {
+        std::cout << "unexpected copy count" << std::endl;
+        return 1;
+    }
+
+    int total = 0;
+    for (auto &p : yield_move_only(5))
+    {
+        std::unique_ptr<int> owned = std::move(p);
+        total += *owned;
+    }
+    std::cout << "move-only total: " << total << std::endl;
+
+    const int n = 1000000;
+    bench("by reference (lvalue)", yield_lvalues(n), n);
+    bench("by reference (rvalue)", yield_rvalues(n), n);
+    bench("copied (const lvalue)", yield_const_lvalues(n), n);
 }
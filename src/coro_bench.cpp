@@ -0,0 +1,344 @@
+// Micro-benchmarks for each awaiter kind from co_awaiters.cpp: ns/op plus,
+// where perf_event_open is permitted, instructions and branch misses per op.
+// Reports median and p99 over samples as a table, or as JSON with --json.
+#include <algorithm>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+class UserFacing {
+  public:
+    class promise_type;
+    using handle_type = std::coroutine_handle<promise_type>;
+    class promise_type {
+      public:
+        UserFacing get_return_object() {
+            auto handle = handle_type::from_promise(*this);
+            return UserFacing{handle};
+        }
+        std::suspend_always initial_suspend() { return {}; }
+        void return_void() {}
+        void unhandled_exception() {}
+        std::suspend_always final_suspend() noexcept { return {}; }
+    };
+
+  private:
+    handle_type handle;
+
+    UserFacing(handle_type handle) : handle(handle) {}
+
+    UserFacing(const UserFacing &) = delete;
+    UserFacing &operator=(const UserFacing &) = delete;
+
+  public:
+    bool resume() {
+        if (!handle.done())
+            handle.resume();
+        return !handle.done();
+    }
+
+    UserFacing(UserFacing &&rhs) : handle(rhs.handle) {
+        rhs.handle = nullptr;
+    }
+    ~UserFacing() {
+        if (handle)
+            handle.destroy();
+    }
+
+    friend class SuspendOtherAwaiter;  // so it can get the handle
+};
+
+class TrivialAwaiter {
+  public:
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<>) {}
+    void await_resume() {}
+};
+
+class ReadyTrueAwaiter {
+  public:
+    bool await_ready() { return true; }
+    void await_suspend(std::coroutine_handle<>) {}
+    void await_resume() {}
+};
+
+class SuspendFalseAwaiter {
+  public:
+    bool await_ready() { return false; }
+    bool await_suspend(std::coroutine_handle<>) { return false; }
+    void await_resume() {}
+};
+
+class SuspendTrueAwaiter {
+  public:
+    bool await_ready() { return false; }
+    bool await_suspend(std::coroutine_handle<>) { return true; }
+    void await_resume() {}
+};
+
+class SuspendSelfAwaiter {
+  public:
+    bool await_ready() { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) {
+        return h;
+    }
+    void await_resume() {}
+};
+
+class SuspendNoopAwaiter {
+  public:
+    bool await_ready() { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<>) {
+        return std::noop_coroutine();
+    }
+    void await_resume() {}
+};
+
+class SuspendOtherAwaiter {
+    std::coroutine_handle<> handle;
+  public:
+    SuspendOtherAwaiter(UserFacing &uf) : handle(uf.handle) {}
+    bool await_ready() { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<>) {
+        return handle;
+    }
+    void await_resume() {}
+};
+
+// ----------------------------------------------------------------------
+// Hardware counters, read as a group around each sample.
+
+class PerfCounters {
+#ifdef __linux__
+    int leader = -1;
+    int branch_misses = -1;
+
+    static int open_counter(std::uint64_t config, int group) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = config;
+        attr.disabled = group == -1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+    }
+
+  public:
+    PerfCounters() {
+        leader = open_counter(PERF_COUNT_HW_INSTRUCTIONS, -1);
+        if (leader != -1)
+            branch_misses = open_counter(PERF_COUNT_HW_BRANCH_MISSES, leader);
+        if (branch_misses == -1 && leader != -1) {
+            close(leader);
+            leader = -1;
+        }
+    }
+    ~PerfCounters() {
+        if (branch_misses != -1)
+            close(branch_misses);
+        if (leader != -1)
+            close(leader);
+    }
+    bool available() const { return leader != -1; }
+    void start() {
+        if (!available())
+            return;
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    // instructions, branch misses
+    std::pair<std::uint64_t, std::uint64_t> stop() {
+        if (!available())
+            return {0, 0};
+        ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        std::uint64_t values[3] = {}; // nr, instructions, branch misses
+        if (read(leader, values, sizeof(values)) != sizeof(values))
+            return {0, 0};
+        return {values[1], values[2]};
+    }
+#else
+  public:
+    bool available() const { return false; }
+    void start() {}
+    std::pair<std::uint64_t, std::uint64_t> stop() { return {0, 0}; }
+#endif
+};
+
+// ----------------------------------------------------------------------
+// One coroutine per sample runs `ops` co_awaits of the awaiter under test;
+// the driver resumes it whenever the awaiter gave control back.
+
+template <typename Awaiter>
+UserFacing await_loop(long ops) {
+    for (long i = 0; i < ops; i++)
+        co_await Awaiter{};
+}
+
+UserFacing await_other_loop(long ops, UserFacing &aux_instance) {
+    for (long i = 0; i < ops; i++)
+        co_await SuspendOtherAwaiter{aux_instance};
+}
+
+UserFacing aux_coroutine() {
+    while (true)
+        co_await std::suspend_always{};
+}
+
+struct Stats {
+    double median = 0;
+    double p99 = 0;
+};
+
+Stats summarize(std::vector<double> samples) {
+    std::sort(samples.begin(), samples.end());
+    auto at = [&](double q) {
+        return samples[std::min(samples.size() - 1, static_cast<std::size_t>(q * samples.size()))];
+    };
+    return {at(0.5), at(0.99)};
+}
+
+struct Result {
+    std::string name;
+    Stats ns;
+    std::optional<Stats> instructions;
+    std::optional<Stats> branch_misses;
+};
+
+template <typename MakeLoop>
+Result measure(const std::string &name, MakeLoop make_loop, PerfCounters &counters,
+               int samples, long ops) {
+    std::vector<double> ns, instructions, branch_misses;
+    for (int s = 0; s < samples; s++) {
+        UserFacing loop = make_loop(ops);
+        counters.start();
+        auto start = std::chrono::steady_clock::now();
+        while (loop.resume()) {
+        }
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        auto [ins, misses] = counters.stop();
+        ns.push_back(elapsed.count() / ops);
+        instructions.push_back(static_cast<double>(ins) / ops);
+        branch_misses.push_back(static_cast<double>(misses) / ops);
+    }
+    Result result{name, summarize(ns), std::nullopt, std::nullopt};
+    if (counters.available()) {
+        result.instructions = summarize(instructions);
+        result.branch_misses = summarize(branch_misses);
+    }
+    return result;
+}
+
+std::string toolchain() {
+    std::ostringstream out;
+#if defined(__clang__)
+    out << "clang " << __clang_major__ << "." << __clang_minor__ << "." << __clang_patchlevel__;
+#elif defined(__GNUC__)
+    out << "gcc " << __GNUC__ << "." << __GNUC_MINOR__ << "." << __GNUC_PATCHLEVEL__;
+#else
+    out << "unknown";
+#endif
+#if defined(_LIBCPP_VERSION)
+    out << " / libc++ " << _LIBCPP_VERSION;
+#elif defined(__GLIBCXX__)
+    out << " / libstdc++ " << __GLIBCXX__;
+#endif
+    return out.str();
+}
+
+void print_table(const std::vector<Result> &results) {
+    std::cout << "toolchain: " << toolchain() << std::endl;
+    std::cout << std::left << std::setw(22) << "awaiter"
+              << std::right << std::setw(12) << "ns median" << std::setw(10) << "ns p99"
+              << std::setw(12) << "insn/op" << std::setw(14) << "br-miss/op" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+    for (auto &r : results) {
+        std::cout << std::left << std::setw(22) << r.name
+                  << std::right << std::setw(12) << r.ns.median << std::setw(10) << r.ns.p99;
+        if (r.instructions)
+            std::cout << std::setw(12) << r.instructions->median << std::setw(14) << std::setprecision(4)
+                      << r.branch_misses->median << std::setprecision(2);
+        else
+            std::cout << std::setw(12) << "n/a" << std::setw(14) << "n/a";
+        std::cout << std::endl;
+    }
+}
+
+void print_json(const std::vector<Result> &results, int samples, long ops) {
+    auto stats = [](const std::optional<Stats> &s) {
+        std::ostringstream out;
+        if (s)
+            out << "{\"median\": " << s->median << ", \"p99\": " << s->p99 << "}";
+        else
+            out << "null";
+        return out.str();
+    };
+    std::cout << "{\n  \"toolchain\": \"" << toolchain() << "\",\n"
+              << "  \"samples\": " << samples << ",\n"
+              << "  \"ops_per_sample\": " << ops << ",\n"
+              << "  \"awaiters\": [\n";
+    for (std::size_t i = 0; i < results.size(); i++) {
+        auto &r = results[i];
+        std::cout << "    {\"name\": \"" << r.name << "\", "
+                  << "\"ns_per_op\": " << stats(r.ns) << ", "
+                  << "\"instructions_per_op\": " << stats(r.instructions) << ", "
+                  << "\"branch_misses_per_op\": " << stats(r.branch_misses) << "}"
+                  << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    std::cout << "  ]\n}" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    bool json = false;
+    int samples = 101;
+    long ops = 100000;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--json")
+            json = true;
+        else if (arg.rfind("--samples=", 0) == 0)
+            samples = std::stoi(arg.substr(10));
+        else if (arg.rfind("--ops=", 0) == 0)
+            ops = std::stol(arg.substr(6));
+        else {
+            std::cerr << "usage: " << argv[0] << " [--json] [--samples=N] [--ops=N]" << std::endl;
+            return 1;
+        }
+    }
+    if (samples < 1 || ops < 1) {
+        std::cerr << "--samples and --ops must be at least 1" << std::endl;
+        return 1;
+    }
+
+    PerfCounters counters;
+    UserFacing aux_instance = aux_coroutine();
+    std::vector<Result> results;
+    results.push_back(measure("TrivialAwaiter", await_loop<TrivialAwaiter>, counters, samples, ops));
+    results.push_back(measure("ReadyTrueAwaiter", await_loop<ReadyTrueAwaiter>, counters, samples, ops));
+    results.push_back(measure("SuspendFalseAwaiter", await_loop<SuspendFalseAwaiter>, counters, samples, ops));
+    results.push_back(measure("SuspendTrueAwaiter", await_loop<SuspendTrueAwaiter>, counters, samples, ops));
+    results.push_back(measure("SuspendSelfAwaiter", await_loop<SuspendSelfAwaiter>, counters, samples, ops));
+    results.push_back(measure("SuspendNoopAwaiter", await_loop<SuspendNoopAwaiter>, counters, samples, ops));
+    results.push_back(measure("SuspendOtherAwaiter", [&](long n) { return await_other_loop(n, aux_instance); },
+                              counters, samples, ops));
+
+    if (json)
+        print_json(results, samples, ops);
+    else
+        print_table(results);
+}
@@ -7,31 +7,229 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 
+// Trace events are recorded as fixed-size binary records into a per-thread
+// lock-free ring. A background writer drains the rings into a binary trace
+// file, and convert() turns that file into the PlantUML sequence diagram.
+// All text (participants, messages, notes) is interned once and referred to
+// by id, so recording an event never formats or allocates.
 class PlantUML
 {
+public:
+    using Id = std::uint32_t;
+
+    enum class Kind : std::uint16_t
+    {
+        StartUml,
+        EndUml,
+        Participant,
+        Message,
+        NoteOver,
+        NoteRight,
+    };
+    // what, if anything, is appended to the event text when it is rendered
+    enum class Arg : std::uint16_t
+    {
+        None,
+        Number,
+        Text,
+    };
+    struct Event
+    {
+        std::uint64_t timestamp;
+        std::int64_t arg;
+        Id from; // participant, or the only participant for notes
+        Id to;
+        Id text;
+        Kind kind;
+        Arg arg_kind;
+    };
+    static_assert(sizeof(Event) == 32);
+
 private:
+    // Single-producer (the traced thread) single-consumer (the writer) ring.
+    struct Ring
+    {
+        static constexpr std::size_t capacity = 1 << 16;
+        std::unique_ptr<Event[]> events = std::make_unique<Event[]>(capacity); // pre-faulted
+        alignas(64) std::atomic<std::size_t> head{0};
+        alignas(64) std::atomic<std::size_t> tail{0};
+        std::size_t cached_head = 0; // producer's last view of head
+
+        void push(const Event &e)
+        {
+            const auto t = tail.load(std::memory_order_relaxed);
+            while (t - cached_head >= capacity)
+            {
+                // full: the writer is behind, wait for it rather than drop
+                cached_head = head.load(std::memory_order_acquire);
+                if (t - cached_head >= capacity)
+                    std::this_thread::yield();
+            }
+            events[t % capacity] = e;
+            tail.store(t + 1, std::memory_order_release);
+        }
+
+        // hands out the pending events as at most two contiguous blocks
+        template <typename F>
+        void drain(F &&f)
+        {
+            const auto h = head.load(std::memory_order_relaxed);
+            const auto t = tail.load(std::memory_order_acquire);
+            if (h == t)
+                return;
+            const auto first = h % capacity, last = t % capacity;
+            if (first < last)
+            {
+                f(&events[first], last - first);
+            }
+            else
+            {
+                f(&events[first], capacity - first);
+                f(&events[0], last);
+            }
+            head.store(t, std::memory_order_release);
+        }
+    };
+
+    struct TextTable
+    {
+        std::mutex mutex;
+        std::unordered_map<std::string, Id> ids;
+        std::vector<std::string> texts;
+    };
+    static TextTable &text_table()
+    {
+        static TextTable table;
+        return table;
+    }
+
+    static inline std::atomic<std::uint64_t> s_next_instance{1};
+    const std::uint64_t m_instance = s_next_instance.fetch_add(1, std::memory_order_relaxed);
     std::string m_file_name;
-    std::ofstream m_file;
+    std::string m_trace_file_name;
+    std::ofstream m_trace;
+    std::mutex m_rings_mutex;
+    std::vector<std::unique_ptr<Ring>> m_rings;
+    std::mutex m_writer_mutex;
+    std::condition_variable m_writer_wakeup;
+    bool m_stop = false;
+    bool m_closed = false;
+    std::thread m_writer;
 
-public:
-    
+    // This thread's ring in this PlantUML. Keyed by instance number rather
+    // than address, so a PlantUML created where a destroyed one used to live
+    // never finds the old one's ring.
+    Ring &local_ring()
+    {
+        struct Cache
+        {
+            std::uint64_t instance = 0;
+            Ring *ring = nullptr;
+        };
+        static thread_local Cache last;
+        if (last.instance == m_instance)
+            return *last.ring;
+        static thread_local std::vector<Cache> rings;
+        auto it = std::find_if(rings.begin(), rings.end(), [this](const Cache &c)
+                               { return c.instance == m_instance; });
+        if (it == rings.end())
+        {
+            std::lock_guard lock(m_rings_mutex);
+            m_rings.push_back(std::make_unique<Ring>());
+            rings.push_back({m_instance, m_rings.back().get()});
+            it = rings.end() - 1;
+        }
+        last = *it;
+        return *last.ring;
+    }
 
-    PlantUML(std::string file_name = "coro_fizz.puml") : m_file_name(std::move(file_name))
+    // Only used to order events from different threads, so the raw TSC is
+    // good enough where we have one and much cheaper than a clock read.
+    static std::uint64_t timestamp()
     {
-        m_file.open(m_file_name);
-        if (!m_file.is_open())
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        const auto now = std::chrono::steady_clock::now().time_since_epoch();
+        return static_cast<std::uint64_t>(std::chrono::nanoseconds(now).count());
+#endif
+    }
+
+    void record(Kind kind, Id from, Id to, Id text, Arg arg_kind = Arg::None, std::int64_t arg = 0)
+    {
+        local_ring().push(Event{timestamp(), arg, from, to, text, kind, arg_kind});
+    }
+
+    void drain_rings()
+    {
+        std::lock_guard lock(m_rings_mutex);
+        for (auto &ring : m_rings)
         {
-            std::cerr << "Failed to open file " << m_file_name << std::endl;
+            ring->drain([this](const Event *events, std::size_t count)
+                        { m_trace.write(reinterpret_cast<const char *>(events), count * sizeof(Event)); });
         }
     }
-    ~PlantUML()
+
+    void write_loop()
+    {
+        std::unique_lock lock(m_writer_mutex);
+        while (!m_stop)
+        {
+            m_writer_wakeup.wait_for(lock, std::chrono::milliseconds(1));
+            drain_rings();
+        }
+    }
+
+    // Trace file layout: events, then the text table, then a footer holding
+    // the offset of the text table.
+    void write_text_table()
     {
-        if (m_file.is_open())
+        const std::uint64_t offset = m_trace.tellp();
+        auto &table = text_table();
+        std::lock_guard lock(table.mutex);
+        const std::uint32_t count = table.texts.size();
+        m_trace.write(reinterpret_cast<const char *>(&count), sizeof(count));
+        for (auto &text : table.texts)
         {
-            m_file.close();
+            const std::uint32_t size = text.size();
+            m_trace.write(reinterpret_cast<const char *>(&size), sizeof(size));
+            m_trace.write(text.data(), size);
         }
+        m_trace.write(reinterpret_cast<const char *>(&offset), sizeof(offset));
+    }
+
+public:
+    PlantUML(std::string file_name = "coro_fizz.puml") : m_file_name(std::move(file_name)), m_trace_file_name(m_file_name + ".trace")
+    {
+        m_trace.open(m_trace_file_name, std::ios::binary);
+        if (!m_trace.is_open())
+        {
+            std::cerr << "Failed to open file " << m_trace_file_name << std::endl;
+        }
+        m_writer = std::thread([this]
+                               { write_loop(); });
+    }
+    ~PlantUML()
+    {
+        close();
     }
     PlantUML(const PlantUML &) = delete;
     PlantUML &operator=(const PlantUML &) = delete;
@@ -42,86 +240,740 @@ public:
         static PlantUML instance;
         return instance;
     }
+
+    static Id intern(std::string_view text)
+    {
+        auto &table = text_table();
+        std::lock_guard lock(table.mutex);
+        auto [it, inserted] = table.ids.try_emplace(std::string(text), static_cast<Id>(table.texts.size()));
+        if (inserted)
+        {
+            table.texts.emplace_back(text);
+        }
+        return it->second;
+    }
+    static std::string text(Id id)
+    {
+        auto &table = text_table();
+        std::lock_guard lock(table.mutex);
+        return id < table.texts.size() ? table.texts[id] : std::string();
+    }
+
+    // Stop the writer, flush everything recorded so far and render the .puml.
+    void close(std::ostream *echo = &std::cout)
+    {
+        if (m_closed)
+            return;
+        m_closed = true;
+        {
+            std::lock_guard lock(m_writer_mutex);
+            m_stop = true;
+        }
+        m_writer_wakeup.notify_one();
+        m_writer.join();
+        drain_rings();
+        write_text_table();
+        m_trace.close();
+        convert(m_trace_file_name, m_file_name, echo);
+    }
+
+    // Offline converter from a binary trace file to PlantUML text.
+    static bool convert(const std::string &trace_file, const std::string &puml_file, std::ostream *echo = nullptr)
+    {
+        std::ifstream in(trace_file, std::ios::binary);
+        std::uint64_t table_offset = 0;
+        in.seekg(-static_cast<std::streamoff>(sizeof(table_offset)), std::ios::end);
+        if (!in.read(reinterpret_cast<char *>(&table_offset), sizeof(table_offset)))
+        {
+            std::cerr << "Failed to read trace " << trace_file << std::endl;
+            return false;
+        }
+
+        std::vector<std::string> texts;
+        in.seekg(table_offset);
+        std::uint32_t count = 0;
+        in.read(reinterpret_cast<char *>(&count), sizeof(count));
+        for (std::uint32_t i = 0; i < count; i++)
+        {
+            std::uint32_t size = 0;
+            in.read(reinterpret_cast<char *>(&size), sizeof(size));
+            std::string text(size, '\0');
+            in.read(text.data(), size);
+            texts.push_back(std::move(text));
+        }
+
+        std::vector<Event> events(table_offset / sizeof(Event));
+        in.seekg(0);
+        in.read(reinterpret_cast<char *>(events.data()), events.size() * sizeof(Event));
+        // rings are drained thread by thread, put events back in time order
+        std::stable_sort(events.begin(), events.end(), [](const Event &a, const Event &b)
+                         { return a.timestamp < b.timestamp; });
+
+        std::ofstream out(puml_file);
+        if (!out.is_open())
+        {
+            std::cerr << "Failed to open file " << puml_file << std::endl;
+            return false;
+        }
+        for (auto &e : events)
+        {
+            std::string text = texts.at(e.text);
+            if (e.arg_kind == Arg::Number)
+                text += std::to_string(e.arg);
+            else if (e.arg_kind == Arg::Text)
+                text += texts.at(e.arg);
+            std::ostringstream line;
+            switch (e.kind)
+            {
+            case Kind::StartUml:
+                line << "@startuml" << "\n";
+                break;
+            case Kind::EndUml:
+                line << "@enduml" << "\n";
+                break;
+            case Kind::Participant:
+                line << "participant " << texts.at(e.from) << "\n";
+                break;
+            case Kind::Message:
+                line << texts.at(e.from) << " -> " << texts.at(e.to) << " : " << text << "\n";
+                break;
+            case Kind::NoteOver:
+                line << "note over " << texts.at(e.from) << "\n"
+                     << text << " \nend note\n"
+                     << "\n";
+                break;
+            case Kind::NoteRight:
+                line << "note right\n"
+                     << text << " \nend note\n"
+                     << "\n";
+                break;
+            }
+            out << line.str();
+            if (echo)
+                *echo << line.str();
+        }
+        return true;
+    }
+
     void startuml()
     {
-        std::cout << "@startuml" << std::endl;
-        m_file << "@startuml" << std::endl;
+        record(Kind::StartUml, 0, 0, 0);
     }
     void enduml()
     {
-        std::cout << "@enduml" << std::endl;
-        m_file << "@enduml" << std::endl;
+        record(Kind::EndUml, 0, 0, 0);
     }
-    void note_right(std::string_view note)
+    void note_right(Id note)
     {
-        std::cout << "note right\n"
-                  << note << " \nend note\n"
-                  << std::endl;
-        m_file << "note right\n"
-               << note << " \nend note\n"
-               << std::endl;
+        record(Kind::NoteRight, 0, 0, note);
     }
 
-    void note_over(std::string_view note, std::string_view participant)
+    void note_over(Id note, Id participant)
     {
-        std::cout << "note over " << participant << "\n"
-                  << note << " \nend note\n"
-                  << std::endl;
-        m_file << "note over " << participant << "\n"
-               << note << " \nend note\n"
-               << std::endl;
+        record(Kind::NoteOver, participant, 0, note);
+    }
+    // the note is rendered with `number` appended
+    void note_over(Id note, Id participant, std::int64_t number)
+    {
+        record(Kind::NoteOver, participant, 0, note, Arg::Number, number);
     }
 
-    void add_participant(std::string_view participant)
+    void add_participant(Id participant)
     {
-        std::cout << "participant " << participant << std::endl;
-        m_file << "participant " << participant << std::endl;
+        record(Kind::Participant, participant, 0, 0);
     }
-    void message(std::string_view from, std::string_view to, std::string_view message)
+    void message(Id from, Id to, Id message)
     {
-        std::cout << from << " -> " << to << " : " << message << std::endl;
-        m_file << from << " -> " << to << " : " << message << std::endl;
+        record(Kind::Message, from, to, message);
     }
-    void message(std::string_view from, std::string_view to, std::string_view message, std::string_view note)
+    void message(Id from, Id to, Id message, Id note)
     {
         this->message(from, to, message);
         note_right(note);
     }
+    // the message is rendered with the text `suffix` appended
+    void message_with_suffix(Id from, Id to, Id message, Id suffix)
+    {
+        record(Kind::Message, from, to, message, Arg::Text, suffix);
+    }
+};
+
+// Compile-time string usable as a template argument, see operator""_t.
+template <std::size_t N>
+struct TraceLiteral
+{
+    char text[N];
+    constexpr TraceLiteral(const char (&s)[N])
+    {
+        std::copy_n(s, N, text);
+    }
+};
+
+// trace_id<"text">() and "text"_t intern the literal on first use and
+// afterwards cost a static load.
+template <TraceLiteral S>
+PlantUML::Id trace_id()
+{
+    static const PlantUML::Id id = PlantUML::intern(S.text);
+    return id;
+}
+
+template <TraceLiteral S>
+PlantUML::Id operator""_t()
+{
+    return trace_id<S>();
+}
+
+// Names a coroutine for its CoroHandler without interning anything, so an
+// untraced handler never touches the text table.
+template <TraceLiteral S>
+struct TraceName
+{
+};
+
+// Per-coroutine time accounting, opt-in with Profiler::enabled. Control moving
+// into a coroutine (enter) ends the running stretch of whichever coroutine had
+// it on this thread; leave() ends it without a successor. Each thread keeps a
+// table indexed by coroutine name id that only it writes, with relaxed atomic
+// stores so report()/report_json() can read it from any thread at any time.
+class Profiler
+{
+public:
+    static inline std::atomic<bool> enabled{false};
+
+    struct Totals
+    {
+        std::uint64_t resumes = 0;
+        std::uint64_t running_ns = 0;
+        std::uint64_t max_running_ns = 0;
+        std::uint64_t suspended_ns = 0;
+    };
+
+    static void enter(PlantUML::Id coroutine)
+    {
+        if (!enabled.load(std::memory_order_relaxed))
+            return;
+        auto &local = this_thread();
+        const std::uint64_t now = clock();
+        local.stop_running(now);
+        if (coroutine >= Local::capacity)
+            return;
+        Slot &slot = local.slots[coroutine];
+        add(slot.resumes, 1);
+        if (slot.suspended_since)
+            add(slot.suspended_ns, now - slot.suspended_since);
+        local.running = coroutine;
+        local.run_start = now;
+    }
+
+    static void leave()
+    {
+        if (!enabled.load(std::memory_order_relaxed))
+            return;
+        this_thread().stop_running(clock());
+    }
+
+    // every thread's table added up, by coroutine name
+    static std::map<std::string, Totals> totals()
+    {
+        std::map<std::string, Totals> result;
+        auto &reg = registry();
+        std::lock_guard lock(reg.mutex);
+        for (auto &local : reg.locals)
+        {
+            for (PlantUML::Id id = 0; id < Local::capacity; id++)
+            {
+                const Slot &slot = local->slots[id];
+                const auto resumes = slot.resumes.load(std::memory_order_relaxed);
+                if (resumes == 0)
+                    continue;
+                Totals &t = result[PlantUML::text(id)];
+                t.resumes += resumes;
+                t.running_ns += slot.running_ns.load(std::memory_order_relaxed);
+                t.max_running_ns = std::max<std::uint64_t>(t.max_running_ns, slot.max_running_ns.load(std::memory_order_relaxed));
+                t.suspended_ns += slot.suspended_ns.load(std::memory_order_relaxed);
+            }
+        }
+        return result;
+    }
+
+    static void report(std::ostream &out)
+    {
+        out << std::left << std::setw(20) << "coroutine" << std::right
+            << std::setw(10) << "resumes" << std::setw(14) << "running us"
+            << std::setw(14) << "max run us" << std::setw(16) << "suspended us" << "\n";
+        for (auto &[name, t] : totals())
+        {
+            out << std::left << std::setw(20) << name << std::right << std::fixed << std::setprecision(3)
+                << std::setw(10) << t.resumes << std::setw(14) << t.running_ns / 1e3
+                << std::setw(14) << t.max_running_ns / 1e3 << std::setw(16) << t.suspended_ns / 1e3 << "\n";
+        }
+        out.flush();
+    }
+
+    static void report_json(std::ostream &out)
+    {
+        out << "{\"coroutines\": [";
+        bool first = true;
+        for (auto &[name, t] : totals())
+        {
+            out << (first ? "\n" : ",\n") << "  {\"name\": \"" << name << "\""
+                << ", \"resumes\": " << t.resumes
+                << ", \"running_ns\": " << t.running_ns
+                << ", \"max_running_ns\": " << t.max_running_ns
+                << ", \"suspended_ns\": " << t.suspended_ns << "}";
+            first = false;
+        }
+        out << "\n]}\n";
+        out.flush();
+    }
+
+    static std::uint64_t clock()
+    {
+        const auto now = std::chrono::steady_clock::now().time_since_epoch();
+        return static_cast<std::uint64_t>(std::chrono::nanoseconds(now).count());
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<std::uint64_t> resumes{0};
+        std::atomic<std::uint64_t> running_ns{0};
+        std::atomic<std::uint64_t> max_running_ns{0};
+        std::atomic<std::uint64_t> suspended_ns{0};
+        std::uint64_t suspended_since = 0; // owner only
+    };
+
+    struct Local
+    {
+        static constexpr PlantUML::Id capacity = 1024; // name ids beyond this aren't profiled
+        std::unique_ptr<Slot[]> slots = std::make_unique<Slot[]>(capacity);
+        PlantUML::Id running = capacity; // none
+        std::uint64_t run_start = 0;
+
+        void stop_running(std::uint64_t now)
+        {
+            if (running == capacity)
+                return;
+            Slot &slot = slots[running];
+            const std::uint64_t ran = now - run_start;
+            add(slot.running_ns, ran);
+            if (ran > slot.max_running_ns.load(std::memory_order_relaxed))
+                slot.max_running_ns.store(ran, std::memory_order_relaxed);
+            slot.suspended_since = now;
+            running = capacity;
+        }
+    };
+
+    // tables outlive their threads so totals() still sees them
+    struct Registry
+    {
+        std::mutex mutex;
+        std::vector<std::shared_ptr<Local>> locals;
+    };
+    static Registry &registry()
+    {
+        static Registry reg;
+        return reg;
+    }
+    static Local &this_thread()
+    {
+        static thread_local std::shared_ptr<Local> local = []
+        {
+            auto created = std::make_shared<Local>();
+            auto &reg = registry();
+            std::lock_guard lock(reg.mutex);
+            reg.locals.push_back(created);
+            return created;
+        }();
+        return *local;
+    }
+
+    // single writer, so a relaxed load and store is enough
+    static void add(std::atomic<std::uint64_t> &counter, std::uint64_t n)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
 };
 
+// Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev) of the same
+// transitions the Profiler sees: every stretch a coroutine runs is a slice
+// on its thread's track, and a symmetric transfer draws a flow arrow from the
+// slice that handed over control to the one that took it. Off until open().
+// Each thread fills a fixed buffer of events and formats it into the file
+// only when it is full, so the traced path neither formats nor takes a lock.
+class ChromeTrace
+{
+public:
+    static inline std::atomic<bool> enabled{false};
+
+    static ChromeTrace &get_instance()
+    {
+        static ChromeTrace instance;
+        return instance;
+    }
+
+    bool open(const std::string &file_name)
+    {
+        m_file.open(file_name);
+        if (!m_file.is_open())
+        {
+            std::cerr << "Failed to open file " << file_name << std::endl;
+            return false;
+        }
+        m_file << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+        m_origin = Profiler::clock();
+        enabled = true;
+        return true;
+    }
+
+    // Write out what every thread still holds. The traced threads must be
+    // idle by now.
+    void close()
+    {
+        if (!enabled.exchange(false))
+            return;
+        std::lock_guard lock(m_mutex);
+        for (auto &local : m_locals)
+        {
+            write_locked(*local);
+            m_file << (m_first ? "\n" : ",\n")
+                   << R"({"name": "thread_name", "ph": "M", "pid": 1, "tid": )" << local->tid
+                   << R"(, "args": {"name": "thread )" << local->tid << R"("}})";
+            m_first = false;
+        }
+        m_file << "\n]}\n";
+        m_file.close();
+    }
+
+    // Control moves into `coroutine` on this thread; `from` names the awaiter
+    // that transferred it there, if any.
+    static void enter(PlantUML::Id coroutine, std::optional<PlantUML::Id> from = std::nullopt)
+    {
+        if (!enabled.load(std::memory_order_relaxed))
+            return;
+        auto &local = get_instance().this_thread();
+        const std::uint64_t now = Profiler::clock();
+        std::uint32_t flow = 0;
+        if (local.running)
+        {
+            if (from)
+            {
+                flow = get_instance().m_next_flow.fetch_add(1, std::memory_order_relaxed);
+                local.push({now, *from, flow, Phase::FlowStart});
+            }
+            local.push({now, 0, 0, Phase::End});
+        }
+        local.push({now, coroutine, 0, Phase::Begin});
+        if (flow)
+            local.push({now, *from, flow, Phase::FlowEnd});
+        local.running = true;
+    }
+
+    static void leave()
+    {
+        if (!enabled.load(std::memory_order_relaxed))
+            return;
+        auto &local = get_instance().this_thread();
+        if (!local.running)
+            return;
+        local.push({Profiler::clock(), 0, 0, Phase::End});
+        local.running = false;
+    }
+
+private:
+    enum class Phase : char
+    {
+        Begin = 'B',
+        End = 'E',
+        FlowStart = 's',
+        FlowEnd = 'f',
+    };
+    struct Event
+    {
+        std::uint64_t timestamp; // ns
+        PlantUML::Id name;
+        std::uint32_t flow;
+        Phase phase;
+    };
+
+    struct Local
+    {
+        static constexpr std::size_t capacity = 1 << 14;
+        std::uint32_t tid = 0;
+        bool running = false;
+        std::vector<Event> events;
+
+        void push(const Event &e)
+        {
+            events.push_back(e);
+            if (events.size() == capacity)
+            {
+                auto &trace = get_instance();
+                std::lock_guard lock(trace.m_mutex);
+                trace.write_locked(*this);
+            }
+        }
+    };
+
+    std::mutex m_mutex; // guards the file and m_locals
+    std::ofstream m_file;
+    std::vector<std::shared_ptr<Local>> m_locals;
+    std::vector<std::string> m_names; // PlantUML texts looked up so far
+    bool m_first = true;
+    std::uint64_t m_origin = 0;
+    std::atomic<std::uint32_t> m_next_flow{1};
+
+    Local &this_thread()
+    {
+        static thread_local std::shared_ptr<Local> local = [this]
+        {
+            auto created = std::make_shared<Local>();
+            created->events.reserve(Local::capacity);
+            std::lock_guard lock(m_mutex);
+            created->tid = static_cast<std::uint32_t>(m_locals.size());
+            m_locals.push_back(created);
+            return created;
+        }();
+        return *local;
+    }
+
+    void write_locked(Local &local)
+    {
+        std::string out;
+        out.reserve(local.events.size() * 96);
+        auto number = [&out](std::uint64_t n)
+        {
+            char digits[24];
+            out.append(digits, std::to_chars(digits, digits + sizeof(digits), n).ptr);
+        };
+        for (auto &e : local.events)
+        {
+            out += m_first ? "\n{" : ",\n{";
+            m_first = false;
+            if (e.phase != Phase::End)
+            {
+                if (e.name >= m_names.size())
+                    m_names.resize(e.name + 1);
+                if (m_names[e.name].empty())
+                    m_names[e.name] = PlantUML::text(e.name);
+                out += "\"name\": \"";
+                out += m_names[e.name];
+                out += "\", ";
+            }
+            if (e.phase == Phase::Begin)
+                out += "\"cat\": \"coroutine\", ";
+            if (e.phase == Phase::FlowStart || e.phase == Phase::FlowEnd)
+            {
+                out += "\"cat\": \"transfer\", \"id\": ";
+                number(e.flow);
+                out += ", ";
+            }
+            if (e.phase == Phase::FlowEnd)
+                out += "\"bp\": \"e\", ";
+            out += "\"ph\": \"";
+            out += static_cast<char>(e.phase);
+            out += "\", \"ts\": ";
+            // microseconds, to the nanosecond
+            const auto ts = e.timestamp - m_origin;
+            number(ts / 1000);
+            out += '.';
+            out += static_cast<char>('0' + ts % 1000 / 100);
+            out += static_cast<char>('0' + ts % 100 / 10);
+            out += static_cast<char>('0' + ts % 10);
+            out += ", \"pid\": 1, \"tid\": ";
+            number(local.tid);
+            out += '}';
+        }
+        m_file << out;
+        local.events.clear();
+    }
+};
+
+// Trace policies for CoroHandler and the pipeline types. Every label is a
+// template argument, so a policy that ignores them never interns one.
+// PlantUMLTrace records every transition into the PlantUML returned by Sink;
+// NoTrace is empty and all of its hooks compile away, leaving the handler
+// exactly a coroutine handle.
+template <PlantUML &(*Sink)() = &PlantUML::get_instance>
+class PlantUMLTrace
+{
+    PlantUML::Id m_name = 0;
+    std::vector<PlantUML::Id> m_transfer_targets;
+
+    explicit PlantUMLTrace(PlantUML::Id name) : m_name(name) {}
+
+public:
+    PlantUMLTrace() = default;
+    template <TraceLiteral Name>
+    static PlantUMLTrace named()
+    {
+        return PlantUMLTrace(trace_id<Name>());
+    }
+
+    template <TraceLiteral Target, TraceLiteral Note>
+    void on_suspend()
+    {
+        Sink().message(m_name, trace_id<Target>(), trace_id<Note>());
+        m_transfer_targets.emplace_back(trace_id<Target>());
+    }
+    void on_resume()
+    {
+        Sink().message(m_transfer_targets.back(), m_name, "resume()"_t);
+    }
+    template <TraceLiteral From>
+    void on_transfer_from()
+    {
+        Sink().message_with_suffix(trace_id<From>(), m_name, "resume "_t, m_name);
+    }
+
+    template <TraceLiteral From, TraceLiteral To, TraceLiteral Text>
+    static void message()
+    {
+        Sink().message(trace_id<From>(), trace_id<To>(), trace_id<Text>());
+    }
+    template <TraceLiteral Note, TraceLiteral Participant>
+    static void note_over()
+    {
+        Sink().note_over(trace_id<Note>(), trace_id<Participant>());
+    }
+    template <TraceLiteral Note, TraceLiteral Participant>
+    static void note_over(std::int64_t number)
+    {
+        Sink().note_over(trace_id<Note>(), trace_id<Participant>(), number);
+    }
+    // control enters or leaves a coroutine that has no CoroHandler
+    template <TraceLiteral Name>
+    static void enter() {}
+    static void leave() {}
+};
+
+struct NoTrace
+{
+    template <TraceLiteral Name>
+    static NoTrace named() { return {}; }
+
+    template <TraceLiteral Target, TraceLiteral Note>
+    void on_suspend() {}
+    void on_resume() {}
+    template <TraceLiteral From>
+    void on_transfer_from() {}
+
+    template <TraceLiteral From, TraceLiteral To, TraceLiteral Text>
+    static void message() {}
+    template <TraceLiteral Note, TraceLiteral Participant>
+    static void note_over() {}
+    template <TraceLiteral Note, TraceLiteral Participant>
+    static void note_over(std::int64_t) {}
+    template <TraceLiteral Name>
+    static void enter() {}
+    static void leave() {}
+};
+
+// Feeds the Profiler and the ChromeTrace timeline, then hands each hook on to
+// Inner.
+template <typename Inner = PlantUMLTrace<>>
+class ProfiledTrace
+{
+    PlantUML::Id m_name = 0;
+    [[no_unique_address]] Inner m_inner;
+
+    ProfiledTrace(PlantUML::Id name, Inner inner) : m_name(name), m_inner(std::move(inner)) {}
+
+public:
+    ProfiledTrace() = default;
+    template <TraceLiteral Name>
+    static ProfiledTrace named()
+    {
+        return ProfiledTrace(trace_id<Name>(), Inner::template named<Name>());
+    }
+
+    template <TraceLiteral Target, TraceLiteral Note>
+    void on_suspend()
+    {
+        // the slice runs on until control actually lands somewhere else
+        Profiler::leave();
+        m_inner.template on_suspend<Target, Note>();
+    }
+    void on_resume()
+    {
+        m_inner.on_resume();
+        Profiler::enter(m_name);
+        ChromeTrace::enter(m_name);
+    }
+    template <TraceLiteral From>
+    void on_transfer_from()
+    {
+        m_inner.template on_transfer_from<From>();
+        Profiler::enter(m_name);
+        ChromeTrace::enter(m_name, trace_id<From>());
+    }
+
+    template <TraceLiteral From, TraceLiteral To, TraceLiteral Text>
+    static void message()
+    {
+        Inner::template message<From, To, Text>();
+    }
+    template <TraceLiteral Note, TraceLiteral Participant>
+    static void note_over()
+    {
+        Inner::template note_over<Note, Participant>();
+    }
+    template <TraceLiteral Note, TraceLiteral Participant>
+    static void note_over(std::int64_t number)
+    {
+        Inner::template note_over<Note, Participant>(number);
+    }
+    template <TraceLiteral Name>
+    static void enter()
+    {
+        Inner::template enter<Name>();
+        Profiler::enter(trace_id<Name>());
+        ChromeTrace::enter(trace_id<Name>());
+    }
+    static void leave()
+    {
+        Inner::leave();
+        Profiler::leave();
+        ChromeTrace::leave();
+    }
+};
+
+using DefaultTrace = ProfiledTrace<>;
+
 // class to wrap the coroutine handle to mark status transition
-template <typename P>
+template <typename P, typename TracePolicy = DefaultTrace>
 class CoroHandler
 {
 public:
-    std::string m_name;
     std::coroutine_handle<P> handle;
-    std::vector<std::string> m_transfer_targets;
-    CoroHandler(std::string name, std::coroutine_handle<P> h) : m_name(std::move(name)), handle(h) {}
-    CoroHandler(const CoroHandler<P> &) = default;
+    [[no_unique_address]] TracePolicy trace;
+    template <TraceLiteral Name>
+    CoroHandler(TraceName<Name>, std::coroutine_handle<P> h) : handle(h), trace(TracePolicy::template named<Name>()) {}
+    CoroHandler(const CoroHandler &) = default;
     template <typename T = P>
-    CoroHandler(const CoroHandler<std::enable_if_t<!std::is_void_v<T>, void>> &h) : m_name(h.m_name), handle(h.handle) {}
+    CoroHandler(const CoroHandler<std::enable_if_t<!std::is_void_v<T>, void>, TracePolicy> &h) : handle(h.handle), trace(h.trace) {}
     CoroHandler() = default;
-    CoroHandler &operator=(const CoroHandler<P> &) = default;
-    CoroHandler(CoroHandler<P> &&s) = default;
-    CoroHandler &operator=(CoroHandler<P> &&s) = default;
+    CoroHandler &operator=(const CoroHandler &) = default;
+    CoroHandler(CoroHandler &&s) = default;
+    CoroHandler &operator=(CoroHandler &&s) = default;
 
     template <typename S = P, typename T>
     CoroHandler &operator=(std::enable_if_t<!std::is_void_v<T> && std::is_void_v<S>, T> &&h)
     {
-        m_name = h.m_name;
+        trace = h.trace;
         handle = h.handle;
         return *this;
     }
-    void suspend(std::string_view target, std::string_view note = "")
+    template <TraceLiteral Target, TraceLiteral Note = "">
+    void suspend()
     {
-        PlantUML::get_instance().message(m_name, target, note);
-        m_transfer_targets.emplace_back(std::string(target));
+        trace.template on_suspend<Target, Note>();
     }
 
     void resume()
     {
-        PlantUML::get_instance().message(m_transfer_targets.back(), m_name, "resume()");
+        trace.on_resume();
         handle.resume();
     }
 
@@ -141,9 +993,10 @@ public:
         return handle != nullptr;
     }
 
-    std::conditional_t<std::is_void_v<P>, std::coroutine_handle<>, std::coroutine_handle<P>> get_handle_to_resume(std::string_view from)
+    template <TraceLiteral From>
+    std::conditional_t<std::is_void_v<P>, std::coroutine_handle<>, std::coroutine_handle<P>> get_handle_to_resume()
     {
-        PlantUML::get_instance().message(from, m_name, "resume " + m_name);
+        trace.template on_transfer_from<From>();
         return handle;
     }
 
@@ -155,51 +1008,51 @@ public:
     }
 };
 
+static_assert(sizeof(CoroHandler<void, NoTrace>) == sizeof(std::coroutine_handle<>));
+
+template <typename Trace = DefaultTrace>
 struct YieldAwaitable
 {
-    std::string m_name;
-    CoroHandler<void> consumer_coro_handle;
-    YieldAwaitable() : consumer_coro_handle("consume_numbers", nullptr)
-    {
-        m_name = "YieldAwaitable";
-    }
-    explicit YieldAwaitable(CoroHandler<void> &h) : m_name("YieldAwaitable"), consumer_coro_handle(h) {}
+    CoroHandler<void, Trace> consumer_coro_handle;
+    YieldAwaitable() : consumer_coro_handle(TraceName<"consume_numbers">{}, nullptr) {}
+    explicit YieldAwaitable(CoroHandler<void, Trace> &h) : consumer_coro_handle(h) {}
     constexpr bool await_ready() const noexcept { return false; }
     std::coroutine_handle<> await_suspend(std::coroutine_handle<>) noexcept
     {
         if (consumer_coro_handle)
         {
-            return consumer_coro_handle.get_handle_to_resume(m_name);
+            return consumer_coro_handle.template get_handle_to_resume<"YieldAwaitable">();
         }
         return std::noop_coroutine();
     }
     void await_resume() noexcept
     {
-        PlantUML::get_instance().message("YieldAwaitable", "consume_numbers", "await_resume");
+        Trace::template message<"YieldAwaitable", "consume_numbers", "await_resume">();
     }
 };
 
 using Value = int;
 // The coroutine that generates numbers
+template <typename Trace = DefaultTrace>
 class GenNumber
 {
 public:
     struct promise_type;
     using handle_type = std::coroutine_handle<promise_type>;
-    CoroHandler<promise_type> handle; // the coroutine handle
+    CoroHandler<promise_type, Trace> handle; // the coroutine handle
     // rule of zero
     GenNumber() = delete;
-    GenNumber(const GenNumber &) = delete;                        // 1. no copy constructor
-    GenNumber &operator=(const GenNumber &) = delete;             // 2. no copy assignment
-    explicit GenNumber(handle_type h) : handle("GenNumber", h) {} // 3. constructor
-    ~GenNumber()                                                  // 4. destructor
+    GenNumber(const GenNumber &) = delete;                                         // 1. no copy constructor
+    GenNumber &operator=(const GenNumber &) = delete;                              // 2. no copy assignment
+    explicit GenNumber(handle_type h) : handle(TraceName<"GenNumber">{}, h) {}     // 3. constructor
+    ~GenNumber()                                                                   // 4. destructor
     {
         if (handle)
         {
             handle.destroy();
         }
     }
-    GenNumber(GenNumber &&s) : handle("GenNumber", s.handle.handle) // 5. move constructor
+    GenNumber(GenNumber &&s) : handle(TraceName<"GenNumber">{}, s.handle.handle) // 5. move constructor
     {
         s.handle.handle = nullptr;
     }
@@ -212,8 +1065,8 @@ public:
     class GenNumberAwaiter
     {
     public:
-        CoroHandler<promise_type> producer_handler;
-        explicit GenNumberAwaiter(const CoroHandler<promise_type> &p) : producer_handler("generate_numbers", p.handle) {}
+        CoroHandler<promise_type, Trace> producer_handler;
+        explicit GenNumberAwaiter(const CoroHandler<promise_type, Trace> &p) : producer_handler(TraceName<"generate_numbers">{}, p.handle) {}
         GenNumberAwaiter(const GenNumberAwaiter &) = default;
         GenNumberAwaiter &operator=(const GenNumberAwaiter &) = default;
         GenNumberAwaiter(GenNumberAwaiter &&) = default;
@@ -221,13 +1074,13 @@ public:
         bool await_ready() const { return false; }
         std::coroutine_handle<promise_type> await_suspend(std::coroutine_handle<>)
         {
-            PlantUML::get_instance().note_over("GenNumberAwaiter::await_suspend", "GenNumberAwaiter");
-            return producer_handler.get_handle_to_resume("GenNumberAwaiter");
+            Trace::template note_over<"GenNumberAwaiter::await_suspend", "GenNumberAwaiter">();
+            return producer_handler.template get_handle_to_resume<"GenNumberAwaiter">();
         }
 
         std::optional<Value> await_resume()
         {
-            PlantUML::get_instance().message("consume_numbers", "GenNumberAwaiter", "await_resume");
+            Trace::template message<"consume_numbers", "GenNumberAwaiter", "await_resume">();
 
             return producer_handler.promise().value;
         }
@@ -238,12 +1091,12 @@ public:
     {
         int limit;
         std::optional<Value> value;
-        CoroHandler<void> consumer_coro_handle;
-        CoroHandler<promise_type> handle;
+        CoroHandler<void, Trace> consumer_coro_handle;
+        CoroHandler<promise_type, Trace> handle;
         promise_type() = default;
         GenNumber get_return_object()
         {
-            this->handle = CoroHandler<promise_type>("generate_numbers", handle_type::from_promise(*this));
+            this->handle = CoroHandler<promise_type, Trace>(TraceName<"generate_numbers">{}, handle_type::from_promise(*this));
             return GenNumber{handle_type::from_promise(*this)};
         }
         std::suspend_always initial_suspend() { return {}; }
@@ -252,28 +1105,30 @@ public:
         void return_void() const {}
         void unhandled_exception() const {}
         // the co_yield expression will call this function
-        YieldAwaitable yield_value(Value v)
+        YieldAwaitable<Trace> yield_value(Value v)
         {
-            this->handle.suspend("YieldAwaitable", "yield_value");
+            this->handle.template suspend<"YieldAwaitable", "yield_value">();
 
             value = v;
-            return YieldAwaitable{consumer_coro_handle};
+            return YieldAwaitable<Trace>{consumer_coro_handle};
         }
     };
 };
 
 // the consumer coroutine
+template <typename Trace = DefaultTrace>
 class Consumer
 {
 public:
     struct promise_type;
     using handle_type = std::coroutine_handle<promise_type>;
+    using Producer = GenNumber<Trace>;
     handle_type handle; // Consumer coroutine handle
     struct promise_type
     {
-        std::optional<Value> value;                             // the value to be returned
-        CoroHandler<GenNumber::promise_type> &producer_handler; // the producer coroutine handle
-        promise_type(GenNumber &source, int divisor) : producer_handler(source.handle) {}
+        std::optional<Value> value;                                                 // the value to be returned
+        CoroHandler<typename Producer::promise_type, Trace> &producer_handler; // the producer coroutine handle
+        promise_type(Producer &source, int) : producer_handler(source.handle) {}
         promise_type(const promise_type &) = delete;
         promise_type &operator=(const promise_type &) = delete;
         Consumer get_return_object()
@@ -285,11 +1140,11 @@ public:
         void return_void() const {}
         void unhandled_exception() const {}
         // await_transform method
-        GenNumber::GenNumberAwaiter await_transform(GenNumber &source)
+        typename Producer::GenNumberAwaiter await_transform(Producer &source)
         {
-            PlantUML::get_instance().message("consume_numbers", "GenNumberAwaiter", "await_transform");
-            auto awaitable = GenNumber::GenNumberAwaiter{source.handle};
-            source.handle.promise().consumer_coro_handle.operator= <void, CoroHandler<promise_type>>(CoroHandler("consume_numbers", std::coroutine_handle<promise_type>::from_promise(*this)));
+            Trace::template message<"consume_numbers", "GenNumberAwaiter", "await_transform">();
+            auto awaitable = typename Producer::GenNumberAwaiter{source.handle};
+            source.handle.promise().consumer_coro_handle.template operator= <void, CoroHandler<promise_type, Trace>>(CoroHandler<promise_type, Trace>(TraceName<"consume_numbers">{}, std::coroutine_handle<promise_type>::from_promise(*this)));
 
             return awaitable;
         }
@@ -328,7 +1183,10 @@ public:
             return {};
         }
         handle.promise().producer_handler.promise().value = {};
+        // the consumer is resumed by its raw handle, so tell the trace here
+        Trace::template enter<"consume_numbers">();
         handle.resume();
+        Trace::leave();
         auto v = handle.promise().producer_handler.promise().value;
         return v;
     }
@@ -338,49 +1196,176 @@ public:
     }
 };
 
-GenNumber generate_numbers(int limit)
+template <typename Trace = DefaultTrace>
+GenNumber<Trace> generate_numbers(int limit)
 {
 
     for (int i = 1; i <= limit; i++)
     {
-        PlantUML::get_instance().note_over("generate_numbers is about to yield " + std::to_string(i), "generate_numbers");
+        Trace::template note_over<"generate_numbers is about to yield ", "generate_numbers">(i);
         Value v = i;
         co_yield v;
     }
 }
 
-Consumer consume_numbers(GenNumber source, int divisor)
+template <typename Trace = DefaultTrace>
+Consumer<Trace> consume_numbers(GenNumber<Trace> source, int divisor)
 {
-    PlantUML::get_instance().note_over("consume_numbers is about to call await_transform", "consume_numbers");
+    Trace::template note_over<"consume_numbers is about to call await_transform", "consume_numbers">();
     while (std::optional<Value> vopt = co_await source) // Consumer::await_transform -> GenNumberAwaiter::await_suspend ->generate_numbers::resume() -> *yieldawaitable::await_suspend* -> consumer_coro_handle.resume() -> GenNumberAwaiter::await_resume
     {
-        PlantUML::get_instance().message("consume_numbers", "GenNumberAwaiter", "co_await");
+        Trace::template message<"consume_numbers", "GenNumberAwaiter", "co_await">();
 
-        PlantUML::get_instance().note_over("consume_numbers co_await result = " + std::to_string(*vopt), "consume_numbers");
+        Trace::template note_over<"consume_numbers co_await result = ", "consume_numbers">(*vopt);
         if (*vopt % divisor == 0)
         {
             co_yield vopt;
         }
-        PlantUML::get_instance().note_over("consume_numbers is about to co_await next value", "consume_numbers");
+        Trace::template note_over<"consume_numbers is about to co_await next value", "consume_numbers">();
+    }
+    Trace::template note_over<"consume_numbers end...", "consume_numbers">();
+}
+
+// Time the record path alone: no formatting, no I/O on the traced thread.
+void bench_tracing(int events)
+{
+    PlantUML trace("coro_fizz_bench.puml");
+    const auto from = "generate_numbers"_t, to = "YieldAwaitable"_t, text = "yield_value"_t;
+    trace.message(from, to, text); // registers this thread's ring
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < events; i++)
+    {
+        trace.message(from, to, text);
     }
-    PlantUML::get_instance().note_over("consume_numbers end...", "consume_numbers");
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "tracing overhead: " << elapsed.count() / events << " ns per transition" << std::endl;
+    trace.close(nullptr);
+    std::remove("coro_fizz_bench.puml");
+    std::remove("coro_fizz_bench.puml.trace");
 }
 
-int main()
+// A coroutine that does nothing but suspend, to time the handler alone.
+struct Ticker
+{
+    struct promise_type
+    {
+        Ticker get_return_object() { return Ticker{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+        std::suspend_always initial_suspend() { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() {}
+    };
+    std::coroutine_handle<promise_type> handle;
+};
+
+Ticker tick()
 {
+    while (true)
+    {
+        co_await std::suspend_always{};
+    }
+}
+
+PlantUML &bench_sink()
+{
+    static PlantUML trace("coro_fizz_bench.puml");
+    return trace;
+}
+
+template <typename TracePolicy>
+void bench_handler(const char *name, int resumes)
+{
+    Ticker ticker = tick();
+    CoroHandler<void, TracePolicy> handler(TraceName<"tick">{}, ticker.handle);
+    handler.template get_handle_to_resume<"main">().resume(); // warm up the trace sink
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < resumes; i++)
+    {
+        handler.template get_handle_to_resume<"main">().resume();
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << name << " (" << sizeof(handler) << " bytes): "
+              << elapsed.count() / resumes << " ns per resume" << std::endl;
+    ticker.handle.destroy();
+}
+
+// The whole generate_numbers -> consume_numbers pipeline under a policy.
+template <typename Trace>
+void bench_pipeline(const char *name, int limit)
+{
+    auto res = consume_numbers<Trace>(generate_numbers<Trace>(limit), 1);
+    long sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (std::optional<Value> vopt = res.next_value())
+    {
+        sum += *vopt;
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << name << ": " << elapsed.count() / limit << " ns per value";
+    if (sum != static_cast<long>(limit) * (limit + 1) / 2)
+        std::cout << " (bad sum " << sum << ")";
+    std::cout << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 4 && std::string_view(argv[1]) == "--convert")
+    {
+        // coro_fizz --convert <file.trace> <file.puml>
+        return PlantUML::convert(argv[2], argv[3]) ? 0 : 1;
+    }
+    if (argc == 2 && std::string_view(argv[1]) == "--bench")
+    {
+        bench_tracing(200000);
+        bench_handler<NoTrace>("CoroHandler<NoTrace>", 200000);
+        bench_handler<PlantUMLTrace<bench_sink>>("CoroHandler<PlantUMLTrace>", 200000);
+        bench_handler<ProfiledTrace<NoTrace>>("CoroHandler<ProfiledTrace> off", 200000);
+        Profiler::enabled = true;
+        bench_handler<ProfiledTrace<NoTrace>>("CoroHandler<ProfiledTrace> on", 200000);
+        Profiler::enabled = false;
+        ChromeTrace::get_instance().open("coro_fizz_bench.json");
+        bench_handler<ProfiledTrace<NoTrace>>("CoroHandler<ProfiledTrace> chrome", 200000);
+        ChromeTrace::get_instance().close();
+        std::remove("coro_fizz_bench.json");
+        bench_pipeline<NoTrace>("pipeline<NoTrace>", 200000);
+        bench_pipeline<ProfiledTrace<PlantUMLTrace<bench_sink>>>("pipeline<ProfiledTrace>", 200000);
+        bench_sink().close(nullptr);
+        std::remove("coro_fizz_bench.puml");
+        std::remove("coro_fizz_bench.puml.trace");
+        return 0;
+    }
+    // coro_fizz [--profile] [--chrome <file.json>]
+    bool profile = false;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string_view arg = argv[i];
+        if (arg == "--profile")
+            Profiler::enabled = profile = true;
+        else if (arg == "--chrome" && i + 1 < argc && !ChromeTrace::get_instance().open(argv[++i]))
+            return 1;
+    }
+
     PlantUML::get_instance().startuml();
-    PlantUML::get_instance().add_participant("main");
-    PlantUML::get_instance().add_participant("consume_numbers");
-    PlantUML::get_instance().add_participant("generate_numbers");
-    PlantUML::get_instance().add_participant("GenNumberAwaiter");
-    PlantUML::get_instance().add_participant("YieldAwaitable");
+    PlantUML::get_instance().add_participant("main"_t);
+    PlantUML::get_instance().add_participant("consume_numbers"_t);
+    PlantUML::get_instance().add_participant("generate_numbers"_t);
+    PlantUML::get_instance().add_participant("GenNumberAwaiter"_t);
+    PlantUML::get_instance().add_participant("YieldAwaitable"_t);
 
     GenNumber c = generate_numbers(1);
     auto res = consume_numbers(std::move(c), 1);
-    PlantUML::get_instance().message("main", "consume_numbers", "consume_numbers.next_value()");
+    PlantUML::get_instance().message("main"_t, "consume_numbers"_t, "consume_numbers.next_value()"_t);
     while (std::optional<Value> vopt = res.next_value())
     {
-        PlantUML::get_instance().note_over("main: consume_numbers next value = " + std::to_string(*vopt), "main");
+        PlantUML::get_instance().note_over("main: consume_numbers next value = "_t, "main"_t, *vopt);
     }
     PlantUML::get_instance().enduml();
+    PlantUML::get_instance().close();
+    ChromeTrace::get_instance().close();
+    if (profile)
+    {
+        Profiler::report(std::cout);
+        std::ofstream json("coro_fizz.profile.json");
+        Profiler::report_json(json);
+    }
 }
@@ -0,0 +1,248 @@
+#include <iostream>
+#include <coroutine>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+
+// Generator<T> is a recursive generator: `co_yield elements_of(inner)` hands
+// every element of `inner` to our consumer without passing through this
+// frame. The root promise remembers which nested generator is currently
+// producing (the leaf), the consumer resumes that leaf directly, and a
+// finished leaf symmetric-transfers back to the generator that delegated to
+// it. Pulling an element costs one resume however deep the nesting is.
+//
+// A stage that transforms every value, like check_multiple, still has to see
+// every value, so a chain of K of them is K resumes per value whichever way
+// it is written; it is the layers that only pass values through (wrappers,
+// concatenation, recursion over a tree) that get cheaper.
+template <typename T>
+class Generator;
+
+template <typename T>
+struct ElementsOf
+{
+    Generator<T> inner;
+};
+
+template <typename T>
+ElementsOf<T> elements_of(Generator<T> inner)
+{
+    return ElementsOf<T>{std::move(inner)};
+}
+
+template <typename T>
+class Generator
+{
+public:
+    struct promise_type;
+    using handle_type = std::coroutine_handle<promise_type>;
+    handle_type handle;
+    struct promise_type
+    {
+        T *value = nullptr;           // on the root: the element being handed out
+        promise_type *root = this;
+        promise_type *leaf = this;    // on the root: the generator that yields next
+        promise_type *parent = nullptr;
+
+        // on reaching the end, continue the generator that delegated to us
+        struct FinalAwaiter
+        {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(handle_type h) noexcept
+            {
+                promise_type &p = h.promise();
+                if (!p.parent)
+                    return std::noop_coroutine();
+                p.root->leaf = p.parent;
+                return handle_type::from_promise(*p.parent);
+            }
+            void await_resume() noexcept {}
+        };
+
+        // run the inner generator in our place until it finishes
+        struct DelegateAwaiter
+        {
+            Generator inner;
+            bool await_ready() { return !inner.handle; }
+            std::coroutine_handle<> await_suspend(handle_type h)
+            {
+                promise_type &outer = h.promise();
+                promise_type &p = inner.handle.promise();
+                p.parent = &outer;
+                p.root = outer.root;
+                outer.root->leaf = &p;
+                return inner.handle;
+            }
+            void await_resume() {}
+        };
+
+        Generator get_return_object()
+        {
+            return Generator{handle_type::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend()
+        {
+            return {};
+        }
+        FinalAwaiter final_suspend() noexcept
+        {
+            return {};
+        }
+        void return_void() {}
+        void unhandled_exception() {}
+        std::suspend_always yield_value(T &v)
+        {
+            root->value = std::addressof(v);
+            return {};
+        }
+        std::suspend_always yield_value(T &&v)
+        {
+            root->value = std::addressof(v);
+            return {};
+        }
+        DelegateAwaiter yield_value(ElementsOf<T> elements)
+        {
+            return DelegateAwaiter{std::move(elements.inner)};
+        }
+    };
+    Generator(handle_type h) : handle(h) {}
+    Generator(Generator &&s) : handle(s.handle)
+    {
+        s.handle = nullptr;
+    }
+    ~Generator()
+    {
+        if (handle)
+        {
+            handle.destroy();
+        }
+    }
+    void next()
+    {
+        if (handle.done())
+        {
+            return;
+        }
+        handle_type::from_promise(*handle.promise().leaf).resume();
+    }
+    T &value()
+    {
+        return *handle.promise().value;
+    }
+    // range access method
+    struct Iter
+    {
+        Generator &gen;
+        bool operator!=(Iter const &) const
+        {
+            return gen.handle && !gen.handle.done();
+        }
+        void operator++() { gen.next(); }
+
+        T &operator*() const
+        {
+            return gen.value();
+        }
+    };
+
+    Iter begin()
+    {
+        next();
+        return Iter{*this};
+    }
+    Iter end()
+    {
+        return Iter{*this};
+    }
+};
+
+// FizzBuzz over [first, last] by splitting the range in halves, so the
+// elements come out of generators nested log2(last - first) deep.
+Generator<std::string> fizzbuzz(int first, int last)
+{
+    if (last - first < 4)
+    {
+        for (int i = first; i <= last; i++)
+        {
+            std::string text;
+            if (i % 3 == 0)
+                text += "Fizz";
+            if (i % 5 == 0)
+                text += "Buzz";
+            if (text.empty())
+                text = std::to_string(i);
+            co_yield text;
+        }
+        co_return;
+    }
+    const int middle = first + (last - first) / 2;
+    co_yield elements_of(fizzbuzz(first, middle));
+    co_yield elements_of(fizzbuzz(middle + 1, last));
+}
+
+Generator<int> numbers(int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        co_yield i;
+    }
+}
+
+// `depth` layers that each just pass their inner generator's elements on
+Generator<int> delegated(int depth, int n)
+{
+    if (depth == 0)
+        co_yield elements_of(numbers(n));
+    else
+        co_yield elements_of(delegated(depth - 1, n));
+}
+
+Generator<int> forwarded(int depth, int n)
+{
+    if (depth == 0)
+    {
+        for (auto &v : numbers(n))
+            co_yield v;
+    }
+    else
+    {
+        for (auto &v : forwarded(depth - 1, n))
+            co_yield v;
+    }
+}
+
+// nanoseconds per element
+template <typename Gen>
+double bench(Gen gen, int n)
+{
+    auto start = std::chrono::steady_clock::now();
+    long sum = 0;
+    for (auto &v : gen)
+    {
+        sum += v;
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    if (sum != static_cast<long>(n) * (n - 1) / 2)
+        std::cout << "bad sum " << sum << std::endl;
+    return elapsed.count() / n;
+}
+
+int main()
+{
+    for (auto &text : fizzbuzz(1, 20))
+    {
+        std::cout << text << std::endl;
+    }
+
+    const int n = 200000;
+    for (int depth : {1, 10, 100, 1000})
+    {
+        const double nested = bench(delegated(depth, n), n);
+        const double plain = bench(forwarded(depth, n), n);
+        std::cout << "depth " << depth
+                  << ": elements_of " << nested << " ns/element"
+                  << ", for + co_yield " << plain << " ns/element" << std::endl;
+    }
+}
@@ -7,65 +7,176 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstddef>
+#include <stdexcept>
+#include <string_view>
 
 std::vector<std::string> g_statuses;
 
+// Streams the sequence diagram to disk while it is being recorded. Lines
+// collect in a fixed-size block that is written out whenever it fills, so
+// memory stays constant however long the run is, and a crash loses at most
+// one block. With rotate_every(bytes) the diagram is split into parts of
+// about that size (coro_fizz_statuses.puml, coro_fizz_statuses.1.puml, ...),
+// each a complete @startuml/@enduml document that repeats the participants.
 class PlantUML
 {
+public:
+    static constexpr std::size_t block_size = 64 * 1024;
+
 private:
     std::string m_file_name;
     std::ofstream m_file;
     std::vector<std::string> m_participants;
-    std::string m_graph_text;
+    std::string m_block;
+    std::size_t m_max_part_bytes = 0; // 0 means one part, however big
+    std::size_t m_part = 0;
+    std::size_t m_part_bytes = 0;
+    std::size_t m_part_lines = 0;
+    bool m_in_part = false;
+    bool m_closed = false;
 
-public:
-    std::string to_plant_uml()
+    std::string part_file_name() const
     {
-        std::string result = "@startuml\n";
+        if (m_part == 0)
+        {
+            return m_file_name;
+        }
+        auto dot = m_file_name.rfind('.');
+        if (dot == std::string::npos)
+        {
+            return m_file_name + "." + std::to_string(m_part);
+        }
+        return m_file_name.substr(0, dot) + "." + std::to_string(m_part) + m_file_name.substr(dot);
+    }
+
+    void open_part()
+    {
+        // m_block already buffers, so don't let the stream buffer again
+        m_file.rdbuf()->pubsetbuf(nullptr, 0);
+        m_file.open(part_file_name());
+        if (!m_file.is_open())
+        {
+            std::cerr << "Failed to open file " << part_file_name() << std::endl;
+        }
+        m_in_part = true;
+        m_part_bytes = 0;
+        m_part_lines = 0;
+        write("@startuml\n");
         for (auto &participant : m_participants)
         {
-            result += "participant " + participant + "\n";
+            write("participant " + participant + "\n");
         }
+        write("\n");
+    }
 
-        result += "\n";
-        result += m_graph_text;
-        result += "@enduml\n";
-        return result;
+    void close_part()
+    {
+        write("@enduml\n");
+        flush_block();
+        m_file.close();
+        m_in_part = false;
+        m_part++;
     }
 
-    void to_file()
+    void flush_block()
     {
-        m_file << to_plant_uml();
+        if (m_file.is_open())
+        {
+            m_file.write(m_block.data(), m_block.size());
+        }
+        m_block.clear();
     }
 
+    void write(std::string_view text)
+    {
+        m_part_bytes += text.size();
+        if (m_block.size() + text.size() > block_size)
+        {
+            flush_block();
+        }
+        if (text.size() > block_size)
+        {
+            m_file.write(text.data(), text.size());
+            return;
+        }
+        m_block.append(text);
+    }
+
+    // one line of the diagram body, starting a new part first if this one is full
+    void line(std::string_view text)
+    {
+        constexpr std::string_view footer = "@enduml\n";
+        if (m_closed)
+        {
+            return;
+        }
+        if (!m_in_part)
+        {
+            open_part();
+        }
+        else if (m_max_part_bytes && m_part_lines > 0 && m_part_bytes + text.size() + footer.size() > m_max_part_bytes)
+        {
+            close_part();
+            open_part();
+        }
+        write(text);
+        m_part_lines++;
+    }
+
+public:
+    // Finish the current part. Called by the destructor too, so the last
+    // part is a valid document even if nobody remembers to.
+    void close()
+    {
+        if (m_closed)
+        {
+            return;
+        }
+        if (!m_in_part)
+        {
+            open_part();
+        }
+        close_part();
+        m_closed = true;
+    }
+
+    void rotate_every(std::size_t max_part_bytes)
+    {
+        m_max_part_bytes = max_part_bytes;
+    }
+
+    // Participants go in each part's header, so they must all be added
+    // before the first line of the diagram is recorded.
     void add_participant(std::string_view participant)
     {
+        if (m_in_part || m_part > 0)
+        {
+            throw std::logic_error("add_participant after the diagram has started: " + std::string(participant));
+        }
         m_participants.push_back(std::string(participant));
     }
     void note_over(std::string_view note)
     {
-        m_graph_text += "note over " + g_statuses.back() + " : " + std::string(note) + "\n";
+        line("note over " + g_statuses.back() + " : " + std::string(note) + "\n");
     }
 
     void message(std::string_view from, std::string_view to, std::string_view message)
     {
         std::string str = std::string(from) + " -> " + std::string(to) + " : " + std::string(message);
-        m_graph_text += str + "\n";
+        line(str + "\n");
     }
     PlantUML(std::string file_name = "coro_fizz_statuses.puml") : m_file_name(std::move(file_name))
     {
-        m_file.open(m_file_name);
-        if (!m_file.is_open())
-        {
-            std::cerr << "Failed to open file " << m_file_name << std::endl;
-        }
+        m_block.reserve(block_size);
     }
     ~PlantUML()
     {
-        if (m_file.is_open())
-        {
-            m_file.close();
-        }
+        close();
     }
     PlantUML(const PlantUML &) = delete;
     PlantUML &operator=(const PlantUML &) = delete;
@@ -77,12 +188,114 @@ public:
         return instance;
     }
 };
+// Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev) written next to
+// the diagram when open() is called: every StatusEnter scope is a slice on its
+// thread's track, with nanosecond timestamps, and a handle fetched by
+// get_handle_to_resume draws a flow arrow from the slice that asked for it to
+// the next slice that begins. Events go straight to the file as they happen.
+class ChromeTrace
+{
+private:
+    std::ofstream m_file;
+    bool m_enabled = false;
+    bool m_first = true;
+    std::chrono::steady_clock::time_point m_origin;
+    std::uint64_t m_next_flow = 1;
+    std::uint64_t m_pending_flow = 0; // bound to the next slice that begins
+
+    static unsigned thread_id()
+    {
+        static std::atomic<unsigned> next{0};
+        static thread_local unsigned id = next++;
+        return id;
+    }
+
+    void event(std::string_view fields)
+    {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_origin).count();
+        char ts[32];
+        std::snprintf(ts, sizeof(ts), "%lld.%03lld", static_cast<long long>(ns / 1000), static_cast<long long>(ns % 1000));
+        m_file << (m_first ? "\n{" : ",\n{") << fields << "\"ts\": " << ts << ", \"pid\": 1, \"tid\": " << thread_id() << "}";
+        m_first = false;
+    }
+
+public:
+    bool open(const std::string &file_name)
+    {
+        m_file.open(file_name);
+        if (!m_file.is_open())
+        {
+            std::cerr << "Failed to open file " << file_name << std::endl;
+            return false;
+        }
+        m_file << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+        m_origin = std::chrono::steady_clock::now();
+        m_enabled = true;
+        return true;
+    }
+    void close()
+    {
+        if (!m_enabled)
+        {
+            return;
+        }
+        m_enabled = false;
+        m_file << "\n]}\n";
+        m_file.close();
+    }
+
+    void begin(std::string_view name)
+    {
+        if (!m_enabled)
+        {
+            return;
+        }
+        event("\"name\": \"" + std::string(name) + "\", \"cat\": \"status\", \"ph\": \"B\", ");
+        if (m_pending_flow)
+        {
+            event("\"name\": \"resume\", \"cat\": \"transfer\", \"id\": " + std::to_string(m_pending_flow) + ", \"bp\": \"e\", \"ph\": \"f\", ");
+            m_pending_flow = 0;
+        }
+    }
+    void end()
+    {
+        if (!m_enabled)
+        {
+            return;
+        }
+        event("\"ph\": \"E\", ");
+    }
+    void transfer()
+    {
+        if (!m_enabled)
+        {
+            return;
+        }
+        m_pending_flow = m_next_flow++;
+        event("\"name\": \"resume\", \"cat\": \"transfer\", \"id\": " + std::to_string(m_pending_flow) + ", \"ph\": \"s\", ");
+    }
+
+    ChromeTrace() = default;
+    ~ChromeTrace()
+    {
+        close();
+    }
+    ChromeTrace(const ChromeTrace &) = delete;
+    ChromeTrace &operator=(const ChromeTrace &) = delete;
+    static ChromeTrace &get_instance()
+    {
+        static ChromeTrace instance;
+        return instance;
+    }
+};
+
 class StatusEnter
 {
 public:
     StatusEnter(std::string_view status)
     {
         g_statuses.push_back(std::string(status));
+        ChromeTrace::get_instance().begin(status);
         if (g_statuses.size() > 1)
         {
             std::string message = "Entering " + g_statuses.back() + " from " + g_statuses[g_statuses.size() - 2];
@@ -91,6 +304,7 @@ public:
     }
     ~StatusEnter()
     {
+        ChromeTrace::get_instance().end();
         g_statuses.pop_back();
         if (g_statuses.size() > 0)
         {
@@ -151,6 +365,7 @@ public:
     std::conditional_t<std::is_void_v<P>, std::coroutine_handle<>, std::coroutine_handle<P>> get_handle_to_resume(std::string_view from)
     {
         StatusEnter status_enter(from);
+        ChromeTrace::get_instance().transfer();
         return handle;
     }
 
@@ -388,19 +603,35 @@ Consumer consume_numbers(GenNumber source, int divisor)
     }
 }
 
-int main()
+// coro_trace [--chrome <file.json>] [limit [max_part_bytes]]
+int main(int argc, char *argv[])
 {
+    if (argc > 2 && std::string_view(argv[1]) == "--chrome")
+    {
+        if (!ChromeTrace::get_instance().open(argv[2]))
+        {
+            return 1;
+        }
+        argc -= 2;
+        argv += 2;
+    }
+    const int limit = argc > 1 ? std::stoi(argv[1]) : 1;
+    if (argc > 2)
+    {
+        PlantUML::get_instance().rotate_every(std::stoul(argv[2]));
+    }
     PlantUML::get_instance().add_participant("main");
     PlantUML::get_instance().add_participant("consume_numbers");
     PlantUML::get_instance().add_participant("generate_numbers");
     PlantUML::get_instance().add_participant("GenNumberAwaiter");
     PlantUML::get_instance().add_participant("YieldAwaitable");
 
-    GenNumber c = generate_numbers(1);
+    GenNumber c = generate_numbers(limit);
     auto res = consume_numbers(std::move(c), 1);
     while (std::optional<Value> vopt = res.next_value())
     {
         std::cout << "value: " << *vopt << std::endl;
     }
-    PlantUML::get_instance().to_file();
+    PlantUML::get_instance().close();
+    // ChromeTrace closes in its destructor, after res has unwound its scopes
 }
@@ -0,0 +1,67 @@
+// Interned FizzBuzz labels, shared by the pipelines whose Value carries label
+// ids instead of strings: fizz_coawait and co_shuttle_compact.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Every distinct label string, stored once; a label id is its index.
+class LabelTable {
+  public:
+    using Id = std::uint8_t;
+    static constexpr std::size_t max_labels = std::numeric_limits<Id>::max() + std::size_t(1);
+
+    // Stages intern their label once when they start, not per value.
+    static Id intern(std::string_view text) {
+        auto &labels = table();
+        for (std::size_t i = 0; i < labels.size(); i++) {
+            if (labels[i] == text)
+                return static_cast<Id>(i);
+        }
+        if (labels.size() == max_labels)
+            throw std::length_error("LabelTable: more than 256 distinct labels");
+        labels.emplace_back(text);
+        return static_cast<Id>(labels.size() - 1);
+    }
+    static const std::string &text(Id id) { return table()[id]; }
+
+  private:
+    static std::vector<std::string> &table() {
+        static std::vector<std::string> labels;
+        return labels;
+    }
+};
+
+// The labels a value has picked up, in the order the stages added them, kept
+// trivially copyable so a Value can be too.
+class Labels {
+  public:
+    static constexpr std::size_t capacity = 11;
+
+    void push_back(LabelTable::Id id) {
+        if (count == capacity)
+            throw std::length_error("Labels: more than 11 labels on one value");
+        ids[count++] = id;
+    }
+    bool empty() const { return count == 0; }
+    std::size_t size() const { return count; }
+    const LabelTable::Id *begin() const { return ids; }
+    const LabelTable::Id *end() const { return ids + count; }
+
+    // the labels' strings, concatenated; only the sink needs them
+    std::string text() const {
+        std::string result;
+        for (LabelTable::Id id : *this)
+            result.append(LabelTable::text(id));
+        return result;
+    }
+
+  private:
+    std::uint8_t count = 0;
+    LabelTable::Id ids[capacity];
+};